@@ -0,0 +1,42 @@
+#pragma once
+#include <memory>
+
+//Outputs of frozen inner layers for all records in one contiguous block, row of record i starts at i * width.
+//T may be narrower than the model type, float halves the memory and the values are converted on read.
+template <typename T = float>
+class ActivationCache {
+public:
+	void Resize(int nRecords, int width, int nFrozen) {
+		if ((long long)nRecords * width > _capacity) {
+			_capacity = (long long)nRecords * width;
+			_values = std::make_unique<T[]>(_capacity);
+		}
+		_nRecords = nRecords;
+		_width = width;
+		_nFrozen = nFrozen;
+	}
+	T* GetRecord(int i) {
+		return _values.get() + (long long)i * _width;
+	}
+	const T* GetRecord(int i) const {
+		return _values.get() + (long long)i * _width;
+	}
+	int GetNumberOfRecords() const {
+		return _nRecords;
+	}
+	int GetWidth() const {
+		return _width;
+	}
+	int GetNumberOfFrozenLayers() const {
+		return _nFrozen;
+	}
+	long long GetBytes() const {
+		return (long long)_nRecords * _width * sizeof(T);
+	}
+private:
+	std::unique_ptr<T[]> _values;
+	long long _capacity = 0;
+	int _nRecords = 0;
+	int _width = 0;
+	int _nFrozen = 0;
+};
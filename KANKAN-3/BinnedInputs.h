@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//Features of training records binned on grids of the first layer, cell index and offset inside the cell
+//for each feature, so that epochs do not locate the same inputs again. All Urysohns of the layer have the
+//same grid for a feature unless grids were changed one by one, functions on other grids are flagged as not
+//matched and use features. Values outside of grid limits are marked as outside, training them extends limits.
+//Bins are valid for grid versions of Urysohns they are made for, KANKAN bins again when any of them changes.
+template <typename T = double>
+class BinnedInputs {
+public:
+	static const uint16_t outside = 0xFFFF;
+	BinnedInputs(const std::unique_ptr<std::unique_ptr<T[]>[]>& features, int nRecords, int nFeatures) : _features(features) {
+		_nRecords = nRecords;
+		_nFeatures = nFeatures;
+		_cells = std::make_unique<uint16_t[]>((size_t)nRecords * nFeatures);
+		_offsets = std::make_unique<float[]>((size_t)nRecords * nFeatures);
+	}
+	//Grid of a feature is the grid of its function in the first Urysohn that has it as table
+	template <typename L>
+	void Bin(const L& layer) {
+		int nUrysohns = layer.GetNumberOfUrysohns();
+		_matched.assign((size_t)nUrysohns * _nFeatures, 0);
+		std::vector<T> xmin(_nFeatures);
+		std::vector<T> xmax(_nFeatures);
+		std::vector<T> invdeltax(_nFeatures);
+		std::vector<int> points(_nFeatures, 0);
+		for (int j = 0; j < _nFeatures; ++j) {
+			for (int u = 0; u < nUrysohns; ++u) {
+				if (layer.GetGrid(u, j, xmin[j], xmax[j], invdeltax[j], points[j]) && points[j] <= outside) break;
+				points[j] = 0;
+			}
+			if (points[j] == 0) continue;
+			for (int u = 0; u < nUrysohns; ++u) {
+				T umin;
+				T umax;
+				T uinvdeltax;
+				int upoints;
+				if (layer.GetGrid(u, j, umin, umax, uinvdeltax, upoints) && umin == xmin[j] && umax == xmax[j] &&
+					uinvdeltax == invdeltax[j] && upoints == points[j]) {
+					_matched[(size_t)u * _nFeatures + j] = 1;
+				}
+			}
+		}
+		//same arithmetic as Urysohn::GetOffset
+		for (int i = 0; i < _nRecords; ++i) {
+			uint16_t* cells = _cells.get() + (size_t)i * _nFeatures;
+			float* offsets = _offsets.get() + (size_t)i * _nFeatures;
+			for (int j = 0; j < _nFeatures; ++j) {
+				T x = _features[i][j];
+				if (points[j] == 0 || x < xmin[j] || x > xmax[j]) {
+					cells[j] = outside;
+					offsets[j] = 0;
+					continue;
+				}
+				T R = (x - xmin[j]) * invdeltax[j];
+				R = std::min(std::max(R, T(0)), static_cast<T>(points[j] - 1));
+				int index = std::min((int)R, points[j] - 2);
+				cells[j] = (uint16_t)index;
+				offsets[j] = static_cast<float>(R - index);
+			}
+		}
+		_versions.clear();
+		for (int u = 0; u < nUrysohns; ++u) {
+			_versions.push_back(layer.GetGridVersion(u));
+		}
+		++_nBinnings;
+	}
+	template <typename L>
+	bool IsCurrent(const L& layer) const {
+		int nUrysohns = layer.GetNumberOfUrysohns();
+		if (nUrysohns != (int)_versions.size()) return false;
+		for (int u = 0; u < nUrysohns; ++u) {
+			if (layer.GetGridVersion(u) != _versions[u]) return false;
+		}
+		return true;
+	}
+	const std::unique_ptr<std::unique_ptr<T[]>[]>& GetFeatures() const {
+		return _features;
+	}
+	const uint16_t* GetCells(int i) const {
+		return _cells.get() + (size_t)i * _nFeatures;
+	}
+	const float* GetOffsets(int i) const {
+		return _offsets.get() + (size_t)i * _nFeatures;
+	}
+	//Flags of features of Urysohn u
+	const char* GetMatched(int u) const {
+		return _matched.data() + (size_t)u * _nFeatures;
+	}
+	int GetNumberOfRecords() const {
+		return _nRecords;
+	}
+	int GetNumberOfBinnings() const {
+		return _nBinnings;
+	}
+	size_t GetBytes() const {
+		return (size_t)_nRecords * _nFeatures * (sizeof(uint16_t) + sizeof(float)) + _matched.size();
+	}
+private:
+	const std::unique_ptr<std::unique_ptr<T[]>[]>& _features;
+	int _nRecords;
+	int _nFeatures;
+	std::unique_ptr<uint16_t[]> _cells;
+	std::unique_ptr<float[]> _offsets;
+	std::vector<char> _matched;
+	std::vector<long long> _versions;
+	int _nBinnings = 0;
+};
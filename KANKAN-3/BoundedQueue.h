@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+//Lock free queue of fixed capacity for any number of producers and consumers. Every cell carries a sequence
+//number, which tells whether the cell is free for the push or filled for the pop of the current lap.
+//Capacity is rounded up to a power of two. TryPush and TryPop never wait, they fail on full or empty queue.
+template <typename V>
+class BoundedQueue {
+public:
+	BoundedQueue(int capacity) {
+		if (capacity < 1) {
+			printf("Fatal: queue capacity must be positive\n");
+			exit(0);
+		}
+		size_t size = 1;
+		while (size < (size_t)capacity) size <<= 1;
+		_mask = size - 1;
+		_cells = std::make_unique<Cell[]>(size);
+		for (size_t i = 0; i < size; ++i) {
+			_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	bool TryPush(const V& value) {
+		size_t position = _tail.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = _cells[position & _mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			long long difference = (long long)sequence - (long long)position;
+			if (difference == 0) {
+				if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					cell.value = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0) {
+				return false;
+			}
+			else {
+				position = _tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	bool TryPop(V& value) {
+		size_t position = _head.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = _cells[position & _mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			long long difference = (long long)sequence - (long long)(position + 1);
+			if (difference == 0) {
+				if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					value = cell.value;
+					cell.sequence.store(position + _mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0) {
+				return false;
+			}
+			else {
+				position = _head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		V value;
+	};
+	std::unique_ptr<Cell[]> _cells;
+	size_t _mask;
+	//producers and consumers work on different cache lines
+	alignas(64) std::atomic<size_t> _tail{ 0 };
+	alignas(64) std::atomic<size_t> _head{ 0 };
+};
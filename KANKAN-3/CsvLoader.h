@@ -0,0 +1,279 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Loader of numeric CSV or TSV files, last nTargets columns are targets. File is mapped into memory and split
+//into chunks at line boundaries, threads count records of chunks, then parse numbers of each chunk straight
+//from the mapped file into rows of features and targets. Limits of columns are found in the same pass.
+//Blank lines are skipped, header line is skipped when requested.
+template <typename T = double>
+class CsvLoader {
+public:
+	CsvLoader(const std::string& fileName, int nTargets, char delimiter = ',', bool header = false, int nThreads = 0) {
+		if (nTargets < 1) {
+			printf("Fatal: loader needs at least one target\n");
+			exit(0);
+		}
+		if (nThreads < 1) nThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+		_nTargets = nTargets;
+		_delimiter = delimiter;
+		Map(fileName);
+		const char* begin = _data;
+		const char* end = _data + _size;
+		if (header) {
+			const char* lineEnd;
+			begin = NextLine(begin, end, lineEnd);
+		}
+		CountColumns(begin, end);
+		Split(begin, end, nThreads * 4);
+		Parse(nThreads);
+		Unmap();
+	}
+	~CsvLoader() {
+		Unmap();
+	}
+	std::unique_ptr<std::unique_ptr<T[]>[]>& GetFeatures() {
+		return _features;
+	}
+	std::unique_ptr<std::unique_ptr<T[]>[]>& GetTargets() {
+		return _targets;
+	}
+	int GetNumberOfRecords() const {
+		return _nRecords;
+	}
+	int GetNumberOfFeatures() const {
+		return _nFeatures;
+	}
+	int GetNumberOfTargets() const {
+		return _nTargets;
+	}
+	//Same limits as Helper::FindMinMaxMatrix gives for loaded matrices
+	void GetFeatureLimits(std::vector<T>& xmin, std::vector<T>& xmax) const {
+		xmin.insert(xmin.end(), _xmin.begin(), _xmin.begin() + _nFeatures);
+		xmax.insert(xmax.end(), _xmax.begin(), _xmax.begin() + _nFeatures);
+	}
+	void GetTargetLimits(std::vector<T>& tmin, std::vector<T>& tmax) const {
+		tmin.insert(tmin.end(), _xmin.begin() + _nFeatures, _xmin.end());
+		tmax.insert(tmax.end(), _xmax.begin() + _nFeatures, _xmax.end());
+	}
+private:
+	struct Chunk {
+		const char* begin;
+		const char* end;
+		int first;
+		int nRecords;
+		//record of the first malformed line, -1 when chunk is parsed
+		int error;
+		std::vector<T> xmin;
+		std::vector<T> xmax;
+	};
+	const char* _data = nullptr;
+	size_t _size = 0;
+#ifdef _WIN32
+	HANDLE _file = INVALID_HANDLE_VALUE;
+	HANDLE _mapping = NULL;
+#endif
+	char _delimiter;
+	int _nFeatures = 0;
+	int _nTargets;
+	int _nRecords = 0;
+	std::vector<Chunk> _chunks;
+	std::unique_ptr<std::unique_ptr<T[]>[]> _features;
+	std::unique_ptr<std::unique_ptr<T[]>[]> _targets;
+	//limits of features followed by limits of targets
+	std::vector<T> _xmin;
+	std::vector<T> _xmax;
+	void Map(const std::string& fileName) {
+#ifdef _WIN32
+		_file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		LARGE_INTEGER size;
+		if (_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size) || size.QuadPart == 0) {
+			printf("Fatal: can not read %s\n", fileName.c_str());
+			exit(0);
+		}
+		_size = (size_t)size.QuadPart;
+		_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (_mapping != NULL) _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		int file = open(fileName.c_str(), O_RDONLY);
+		struct stat status;
+		if (file < 0 || fstat(file, &status) != 0 || status.st_size == 0) {
+			printf("Fatal: can not read %s\n", fileName.c_str());
+			exit(0);
+		}
+		_size = (size_t)status.st_size;
+		void* data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+		if (data != MAP_FAILED) {
+			_data = (const char*)data;
+			madvise(data, _size, MADV_SEQUENTIAL);
+		}
+#endif
+		if (_data == nullptr) {
+			printf("Fatal: can not map %s\n", fileName.c_str());
+			exit(0);
+		}
+	}
+	void Unmap() {
+		if (_data == nullptr) return;
+#ifdef _WIN32
+		UnmapViewOfFile(_data);
+		CloseHandle(_mapping);
+		CloseHandle(_file);
+#else
+		munmap((void*)_data, _size);
+#endif
+		_data = nullptr;
+	}
+	//Returns start of the next line, line end excludes carriage return
+	static const char* NextLine(const char* p, const char* end, const char*& lineEnd) {
+		const char* newline = (const char*)memchr(p, '\n', end - p);
+		const char* next = (newline == nullptr) ? end : newline + 1;
+		lineEnd = (newline == nullptr) ? end : newline;
+		if (lineEnd > p && lineEnd[-1] == '\r') --lineEnd;
+		return next;
+	}
+	void CountColumns(const char* p, const char* end) {
+		while (p < end) {
+			const char* lineEnd;
+			const char* next = NextLine(p, end, lineEnd);
+			if (lineEnd > p) {
+				int nColumns = 1 + (int)std::count(p, lineEnd, _delimiter);
+				_nFeatures = nColumns - _nTargets;
+				break;
+			}
+			p = next;
+		}
+		if (_nFeatures < 1) {
+			printf("Fatal: file has no records or too few columns for %d targets\n", _nTargets);
+			exit(0);
+		}
+	}
+	//Chunk boundaries are moved forward to the starts of lines
+	void Split(const char* begin, const char* end, int nChunks) {
+		size_t bytes = end - begin;
+		nChunks = (int)std::max<size_t>(1, std::min<size_t>(nChunks, bytes / (1 << 16) + 1));
+		const char* start = begin;
+		for (int c = 0; c < nChunks; ++c) {
+			const char* stop = (c == nChunks - 1) ? end : begin + bytes * (c + 1) / nChunks;
+			if (stop < start) stop = start;
+			if (stop < end && stop > begin && stop[-1] != '\n') {
+				const char* newline = (const char*)memchr(stop, '\n', end - stop);
+				stop = (newline == nullptr) ? end : newline + 1;
+			}
+			Chunk chunk;
+			chunk.begin = start;
+			chunk.end = stop;
+			chunk.first = 0;
+			chunk.nRecords = 0;
+			chunk.error = -1;
+			_chunks.push_back(chunk);
+			start = stop;
+		}
+	}
+	void Parse(int nThreads) {
+		ThreadPool pool(nThreads);
+		int nChunks = (int)_chunks.size();
+		pool.Run(nChunks, [this](int c) {
+			Chunk& chunk = _chunks[c];
+			const char* p = chunk.begin;
+			while (p < chunk.end) {
+				const char* lineEnd;
+				const char* next = NextLine(p, chunk.end, lineEnd);
+				if (lineEnd > p) ++chunk.nRecords;
+				p = next;
+			}
+		});
+		for (int c = 0; c < nChunks; ++c) {
+			_chunks[c].first = _nRecords;
+			_nRecords += _chunks[c].nRecords;
+		}
+		_features = std::make_unique<std::unique_ptr<T[]>[]>(_nRecords);
+		_targets = std::make_unique<std::unique_ptr<T[]>[]>(_nRecords);
+		pool.Run(nChunks, [this](int c) {
+			ParseChunk(_chunks[c]);
+		});
+		int nColumns = _nFeatures + _nTargets;
+		_xmin.assign(nColumns, std::numeric_limits<T>::max());
+		_xmax.assign(nColumns, -std::numeric_limits<T>::max());
+		for (int c = 0; c < nChunks; ++c) {
+			if (_chunks[c].error >= 0) {
+				printf("Fatal: record %d is not %d finite numbers separated by '%c'\n", _chunks[c].error + 1, nColumns, _delimiter);
+				exit(0);
+			}
+			if (_chunks[c].nRecords == 0) continue;
+			for (int j = 0; j < nColumns; ++j) {
+				_xmin[j] = std::min(_xmin[j], _chunks[c].xmin[j]);
+				_xmax[j] = std::max(_xmax[j], _chunks[c].xmax[j]);
+			}
+		}
+	}
+	void ParseChunk(Chunk& chunk) {
+		int nColumns = _nFeatures + _nTargets;
+		chunk.xmin.assign(nColumns, std::numeric_limits<T>::max());
+		chunk.xmax.assign(nColumns, -std::numeric_limits<T>::max());
+		int record = chunk.first;
+		const char* p = chunk.begin;
+		while (p < chunk.end) {
+			const char* lineEnd;
+			const char* next = NextLine(p, chunk.end, lineEnd);
+			if (lineEnd == p) {
+				p = next;
+				continue;
+			}
+			_features[record] = std::make_unique<T[]>(_nFeatures);
+			_targets[record] = std::make_unique<T[]>(_nTargets);
+			T* features = _features[record].get();
+			T* targets = _targets[record].get();
+			for (int j = 0; j < nColumns; ++j) {
+				while (p < lineEnd && (*p == ' ' || (*p == '\t' && _delimiter != '\t'))) ++p;
+				if (p < lineEnd && *p == '+') ++p;
+				T value;
+				auto result = std::from_chars(p, lineEnd, value);
+				//nan and inf are parsed too, they would spoil limits of grids
+				if (result.ec != std::errc() || !std::isfinite(value)) {
+					chunk.error = record;
+					return;
+				}
+				p = result.ptr;
+				while (p < lineEnd && (*p == ' ' || (*p == '\t' && _delimiter != '\t'))) ++p;
+				char expected = (j == nColumns - 1) ? '\n' : _delimiter;
+				if (expected == '\n' ? p != lineEnd : (p == lineEnd || *p != expected)) {
+					chunk.error = record;
+					return;
+				}
+				++p;
+				if (j < _nFeatures) features[j] = value;
+				else targets[j - _nFeatures] = value;
+				if (value < chunk.xmin[j]) chunk.xmin[j] = value;
+				if (value > chunk.xmax[j]) chunk.xmax[j] = value;
+			}
+			++record;
+			p = next;
+		}
+	}
+};
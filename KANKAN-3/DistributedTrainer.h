@@ -0,0 +1,64 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "KANKAN.h"
+#include "Transport.h"
+
+//Data parallel training, every process trains own replica on its shard of data and replicas
+//are averaged after each interval of records. Shards may have different sizes, the number
+//of synchronizations per epoch is agreed between ranks.
+template <typename T = double, typename A = T>
+class DistributedTrainer {
+public:
+	DistributedTrainer(KANKAN<T, A>& kankan, Transport& transport, int interval) : _kankan(kankan), _transport(transport) {
+		if (interval < 1) {
+			printf("Fatal: synchronization interval must be positive\n");
+			exit(0);
+		}
+		_interval = interval;
+		_kankan.Broadcast(_transport);
+	}
+	void TrainEpoch(const std::unique_ptr<std::unique_ptr<T[]>[]>& features,
+		const std::unique_ptr<std::unique_ptr<T[]>[]>& targets, int nRecords) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<double> rounds(1, (double)((nRecords + _interval - 1) / _interval));
+		_transport.AllReduce(rounds, ReduceOperation::Max);
+		for (int round = 0; round < (int)rounds[0]; ++round) {
+			int first = std::min(round * _interval, nRecords);
+			int last = std::min(first + _interval, nRecords);
+			for (int i = first; i < last; ++i) {
+				_kankan.Train(features[i], targets[i]);
+			}
+			auto sync = std::chrono::steady_clock::now();
+			_kankan.Synchronize(_transport);
+			_syncTime += Seconds(sync);
+			++_nSynchronizations;
+		}
+		_trainTime += Seconds(start);
+		_nRecords += nRecords;
+		std::vector<double> records(1, (double)nRecords);
+		_transport.AllReduce(records, ReduceOperation::Sum);
+		_nTotalRecords += records[0];
+	}
+	//Local and aggregated throughput in records per second
+	void ShowStatistics() const {
+		printf("Rank %d of %d, interval %d, synchronizations %lld, local %.0f records/s, all ranks %.0f records/s, synchronization %.1f%% of time\n",
+			_transport.GetRank(), _transport.GetSize(), _interval, _nSynchronizations,
+			_nRecords / _trainTime, _nTotalRecords / _trainTime, 100.0 * _syncTime / _trainTime);
+	}
+private:
+	KANKAN<T, A>& _kankan;
+	Transport& _transport;
+	int _interval;
+	long long _nSynchronizations = 0;
+	double _nRecords = 0.0;
+	double _nTotalRecords = 0.0;
+	double _trainTime = 0.0;
+	double _syncTime = 0.0;
+	static double Seconds(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+};
@@ -0,0 +1,184 @@
+#pragma once
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Helper.h"
+#include "KANKAN.h"
+#include "ThreadPool.h"
+
+//Validation overlapped with training. At the end of epoch the trainer submits a copy of the model and goes on
+//with the next epoch, validation thread computes RMSE and Pearsons of targets on the copy and queues the result.
+//Trainer polls results between epochs, so stopping decision comes one epoch later than with validation inline.
+//When maxPending copies wait for validation Submit waits too, memory taken by copies stays bounded.
+template <typename T = double, typename A = T>
+class EpochValidator {
+public:
+	struct Result {
+		int epoch;
+		double rmse;
+		std::vector<double> pearsons;
+		//time of validation on its own thread
+		double seconds;
+	};
+	EpochValidator(const std::unique_ptr<std::unique_ptr<T[]>[]>& features, const std::unique_ptr<std::unique_ptr<T[]>[]>& targets,
+		int nRecords, int nTargets, int nThreads, int maxPending) : _features(features), _pool(nThreads) {
+		if (nRecords < 1 || nTargets < 1 || maxPending < 1) {
+			printf("Fatal: epoch validator configuration error\n");
+			exit(0);
+		}
+		_nRecords = nRecords;
+		_nTargets = nTargets;
+		_maxPending = maxPending;
+		for (int j = 0; j < nTargets; ++j) {
+			_actual.push_back(std::make_unique<T[]>(nRecords));
+			_computed.push_back(std::make_unique<T[]>(nRecords));
+			for (int i = 0; i < nRecords; ++i) {
+				_actual[j][i] = targets[i][j];
+			}
+		}
+		_thread = std::thread(&EpochValidator::Loop, this);
+	}
+	//Snapshots not yet validated and results not polled are dropped
+	~EpochValidator() {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_stop = true;
+			while ((int)_pending.size() > (_busy ? 1 : 0)) {
+				_pending.pop_back();
+			}
+		}
+		_changed.notify_all();
+		_thread.join();
+	}
+	void Submit(const KANKAN<T, A>& kankan, int epoch) {
+		auto start = Clock::now();
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_changed.wait(lock, [this] { return (int)_pending.size() < _maxPending; });
+		}
+		auto copied = Clock::now();
+		Snapshot snapshot;
+		snapshot.model = std::make_unique<KANKAN<T, A>>(kankan);
+		snapshot.epoch = epoch;
+		_waitTime += std::chrono::duration<double>(copied - start).count();
+		_copyTime += std::chrono::duration<double>(Clock::now() - copied).count();
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_pending.push_back(std::move(snapshot));
+		}
+		_changed.notify_all();
+	}
+	//Returns immediately, false when no result is ready
+	bool Poll(Result& result) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (_results.empty()) return false;
+		result = _results.front();
+		_results.pop_front();
+		return true;
+	}
+	//Waits for the next result, false when nothing was submitted since the last result
+	bool Wait(Result& result) {
+		auto start = Clock::now();
+		std::unique_lock<std::mutex> lock(_mutex);
+		_changed.wait(lock, [this] { return !_results.empty() || (_pending.empty() && !_busy); });
+		_waitTime += std::chrono::duration<double>(Clock::now() - start).count();
+		if (_results.empty()) return false;
+		result = _results.front();
+		_results.pop_front();
+		return true;
+	}
+	//Time taken from the trainer by copies and waits against time of validation done aside
+	void ShowStatistics() const {
+		std::unique_lock<std::mutex> lock(_mutex);
+		printf("Validations %d, validation time %.3f, trainer time for copies %.3f, waits %.3f\n",
+			_nValidated, _validationTime, _copyTime, _waitTime);
+	}
+private:
+	typedef std::chrono::steady_clock Clock;
+	struct Snapshot {
+		std::unique_ptr<KANKAN<T, A>> model;
+		int epoch;
+	};
+	const std::unique_ptr<std::unique_ptr<T[]>[]>& _features;
+	std::vector<std::unique_ptr<T[]>> _actual;
+	std::vector<std::unique_ptr<T[]>> _computed;
+	int _nRecords;
+	int _nTargets;
+	int _maxPending;
+	ThreadPool _pool;
+	std::thread _thread;
+	mutable std::mutex _mutex;
+	std::condition_variable _changed;
+	std::deque<Snapshot> _pending;
+	std::deque<Result> _results;
+	bool _busy = false;
+	bool _stop = false;
+	int _nValidated = 0;
+	double _validationTime = 0.0;
+	//trainer thread only
+	double _copyTime = 0.0;
+	double _waitTime = 0.0;
+	//snapshot stays in the queue while validated, so it counts against maxPending
+	void Loop() {
+		while (true) {
+			const KANKAN<T, A>* model;
+			int epoch;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_changed.wait(lock, [this] { return _stop || !_pending.empty(); });
+				if (_stop) return;
+				model = _pending.front().model.get();
+				epoch = _pending.front().epoch;
+				_busy = true;
+			}
+			auto start = Clock::now();
+			Result result;
+			result.epoch = epoch;
+			result.rmse = Validate(*model);
+			for (int j = 0; j < _nTargets; ++j) {
+				result.pearsons.push_back(Helper::Pearson(_computed[j], _actual[j], _nRecords));
+			}
+			result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				if (!_pending.empty()) _pending.pop_front();
+				_results.push_back(result);
+				_busy = false;
+				++_nValidated;
+				_validationTime += result.seconds;
+			}
+			_changed.notify_all();
+		}
+	}
+	//Records are split between threads of the pool in fixed ranges, each range has own workspace
+	double Validate(const KANKAN<T, A>& model) {
+		int nTasks = _pool.GetNumberOfThreads();
+		std::vector<double> errors(nTasks, 0.0);
+		_pool.Run(nTasks, [&](int t) {
+			auto workspace = model.CreateWorkspace();
+			auto predicted = std::make_unique<T[]>(_nTargets);
+			int first = (int)((long long)_nRecords * t / nTasks);
+			int last = (int)((long long)_nRecords * (t + 1) / nTasks);
+			for (int i = first; i < last; ++i) {
+				model.Predict(_features[i], predicted, *workspace);
+				for (int j = 0; j < _nTargets; ++j) {
+					double error = _actual[j][i] - predicted[j];
+					errors[t] += error * error;
+					_computed[j][i] = predicted[j];
+				}
+			}
+		});
+		double error = 0.0;
+		for (int t = 0; t < nTasks; ++t) {
+			error += errors[t];
+		}
+		return sqrt(error / _nTargets / _nRecords);
+	}
+};
@@ -1,11 +1,14 @@
 #pragma once
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <vector>
 
 class Helper
 {
 public:
-    static double Pearson(const std::unique_ptr<double[]>& x, const std::unique_ptr<double[]>& y, int len) {
+    template <typename T>
+    static double Pearson(const std::unique_ptr<T[]>& x, const std::unique_ptr<T[]>& y, int len) {
         double xmean = 0.0;
         double ymean = 0.0;
         for (int i = 0; i < len; ++i) {
@@ -30,7 +33,8 @@ public:
         stdY = sqrt(stdY);
         return covariance / stdX / stdY;
     }
-    static void ShowMatrix(std::unique_ptr<std::unique_ptr<double[]>[]>& matrix, int rows, int cols) {
+    template <typename T>
+    static void ShowMatrix(std::unique_ptr<std::unique_ptr<T[]>[]>& matrix, int rows, int cols) {
         for (int i = 0; i < rows; ++i) {
             for (int j = 0; j < cols; ++j) {
                 printf("%5.3f ", matrix[i][j]);
@@ -38,7 +42,8 @@ public:
             printf("\n");
         }
     }
-    static void ShowVector(std::unique_ptr<double[]>& ptr, int N) {
+    template <typename T>
+    static void ShowVector(std::unique_ptr<T[]>& ptr, int N) {
         int cnt = 0;
         for (int i = 0; i < N; ++i) {
             printf("%5.2f ", ptr[i]);
@@ -48,8 +53,9 @@ public:
             }
         }
     }
-    static void SwapRows(std::unique_ptr<double[]>& row1, std::unique_ptr<double[]>& row2, int cols) {
-        auto ptr = std::make_unique<double[]>(cols);
+    template <typename T>
+    static void SwapRows(std::unique_ptr<T[]>& row1, std::unique_ptr<T[]>& row2, int cols) {
+        auto ptr = std::make_unique<T[]>(cols);
         for (int i = 0; i < cols; ++i) {
             ptr[i] = row1[i];
         }
@@ -60,12 +66,14 @@ public:
             row2[i] = ptr[i];
         }
     }
-    static void SwapScalars(double& x1, double& x2) {
-        double buff = x1;
+    template <typename T>
+    static void SwapScalars(T& x1, T& x2) {
+        T buff = x1;
         x1 = x2;
         x2 = buff;
     }
-    static void Shuffle(std::unique_ptr<std::unique_ptr<double[]>[]>& matrix, std::unique_ptr<double[]>& vector, int rows, int cols) {
+    template <typename T>
+    static void Shuffle(std::unique_ptr<std::unique_ptr<T[]>[]>& matrix, std::unique_ptr<T[]>& vector, int rows, int cols) {
         for (int i = 0; i < 2 * rows; ++i) {
             int n1 = rand() % rows;
             int n2 = rand() % rows;
@@ -73,72 +81,127 @@ public:
             SwapScalars(vector[n1], vector[n2]);
         }
     }
-    static void FindMinMaxMatrix(std::vector<double>& xmin, std::vector<double>& xmax,
-        std::unique_ptr<std::unique_ptr<double[]>[]>& matrix, int nRows, int nCols) {
+    template <typename T>
+    static void FindMinMaxMatrix(std::vector<T>& xmin, std::vector<T>& xmax,
+        std::unique_ptr<std::unique_ptr<T[]>[]>& matrix, int nRows, int nCols) {
         for (int i = 0; i < nCols; ++i) {
-            xmin.push_back(DBL_MAX);
-            xmax.push_back(-DBL_MAX);
+            xmin.push_back(std::numeric_limits<T>::max());
+            xmax.push_back(-std::numeric_limits<T>::max());
         }
         for (int i = 0; i < nRows; ++i) {
             for (int j = 0; j < nCols; ++j) {
-                if (matrix[i][j] < xmin[j]) xmin[j] = static_cast<double>(matrix[i][j]);
-                if (matrix[i][j] > xmax[j]) xmax[j] = static_cast<double>(matrix[i][j]);
+                if (matrix[i][j] < xmin[j]) xmin[j] = matrix[i][j];
+                if (matrix[i][j] > xmax[j]) xmax[j] = matrix[i][j];
             }
         }
     }
 
-    static void FindMinMax(std::vector<double>& xmin, std::vector<double>& xmax,
-        double& targetMin, double& targetMax,
-        std::unique_ptr<std::unique_ptr<double[]>[]>& matrix,
-        std::unique_ptr<double[]>& target, int nRows, int nCols) {
+    template <typename T>
+    static void FindMinMax(std::vector<T>& xmin, std::vector<T>& xmax,
+        T& targetMin, T& targetMax,
+        std::unique_ptr<std::unique_ptr<T[]>[]>& matrix,
+        std::unique_ptr<T[]>& target, int nRows, int nCols) {
 
         for (int i = 0; i < nCols; ++i) {
-            xmin.push_back(DBL_MAX);
-            xmax.push_back(-DBL_MAX);
+            xmin.push_back(std::numeric_limits<T>::max());
+            xmax.push_back(-std::numeric_limits<T>::max());
         }
         for (int i = 0; i < nRows; ++i) {
             for (int j = 0; j < nCols; ++j) {
-                if (matrix[i][j] < xmin[j]) xmin[j] = static_cast<double>(matrix[i][j]);
-                if (matrix[i][j] > xmax[j]) xmax[j] = static_cast<double>(matrix[i][j]);
+                if (matrix[i][j] < xmin[j]) xmin[j] = matrix[i][j];
+                if (matrix[i][j] > xmax[j]) xmax[j] = matrix[i][j];
             }
         }
-        targetMin = DBL_MAX;
-        targetMax = -DBL_MAX;
+        targetMin = std::numeric_limits<T>::max();
+        targetMax = -std::numeric_limits<T>::max();
         for (int j = 0; j < nRows; ++j) {
             if (target[j] < targetMin) targetMin = target[j];
             if (target[j] > targetMax) targetMax = target[j];
         }
     }
 
-    static double Min(const std::unique_ptr<double[]>& x, int N) {
-        double min = x[0];
+    template <typename T>
+    static T Min(const std::unique_ptr<T[]>& x, int N) {
+        T min = x[0];
         for (int i = 1; i < N; ++i) {
             if (x[i] < min) min = x[i];
         }
         return min;
     }
 
-    static double Max(const std::unique_ptr<double[]>& x, int N) {
-        double max = x[0];
+    template <typename T>
+    static T Max(const std::unique_ptr<T[]>& x, int N) {
+        T max = x[0];
         for (int i = 1; i < N; ++i) {
             if (x[i] > max) max = x[i];
         }
         return max;
     }
 
-    static double MinV(const std::vector<double>& x) {
-        double min = x[0];
+    template <typename T>
+    static T MinV(const std::vector<T>& x) {
+        T min = x[0];
         for (int i = 1; i < x.size(); ++i) {
             if (x[i] < min) min = x[i];
         }
         return min;
     }
 
-    static double MaxV(const std::vector<double>& x) {
-        double max = x[0];
+    template <typename T>
+    static T MaxV(const std::vector<T>& x) {
+        T max = x[0];
         for (int i = 1; i < x.size(); ++i) {
             if (x[i] > max) max = x[i];
         }
         return max;
     }
+
+    //Solves symmetric positive definite system by Cholesky decomposition, matrix is n by n row by row,
+    //it is overwritten by the factor and right side is overwritten by the solution. Returns false when not positive.
+    static bool SolveSymmetric(std::vector<double>& matrix, std::vector<double>& b, int n) {
+        for (int j = 0; j < n; ++j) {
+            double d = matrix[j * n + j];
+            for (int k = 0; k < j; ++k) {
+                d -= matrix[j * n + k] * matrix[j * n + k];
+            }
+            if (d <= 0.0) return false;
+            d = sqrt(d);
+            matrix[j * n + j] = d;
+            for (int i = j + 1; i < n; ++i) {
+                double s = matrix[i * n + j];
+                for (int k = 0; k < j; ++k) {
+                    s -= matrix[i * n + k] * matrix[j * n + k];
+                }
+                matrix[i * n + j] = s / d;
+            }
+        }
+        for (int i = 0; i < n; ++i) {
+            double s = b[i];
+            for (int k = 0; k < i; ++k) {
+                s -= matrix[i * n + k] * b[k];
+            }
+            b[i] = s / matrix[i * n + i];
+        }
+        for (int i = n - 1; i >= 0; --i) {
+            double s = b[i];
+            for (int k = i + 1; k < n; ++k) {
+                s -= matrix[k * n + i] * b[k];
+            }
+            b[i] = s / matrix[i * n + i];
+        }
+        return true;
+    }
+
+    //Copy of dataset in another scalar type, for example float
+    template <typename T, typename S>
+    static std::unique_ptr<std::unique_ptr<T[]>[]> Convert(const std::unique_ptr<std::unique_ptr<S[]>[]>& matrix, int rows, int cols) {
+        auto converted = std::make_unique<std::unique_ptr<T[]>[]>(rows);
+        for (int i = 0; i < rows; ++i) {
+            converted[i] = std::make_unique<T[]>(cols);
+            for (int j = 0; j < cols; ++j) {
+                converted[i][j] = static_cast<T>(matrix[i][j]);
+            }
+        }
+        return converted;
+    }
 };
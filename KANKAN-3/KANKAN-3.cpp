@@ -16,11 +16,24 @@
 //https://www.sciencedirect.com/science/article/abs/pii/S0952197620303742
 //https://arxiv.org/abs/2305.08194
 
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include "Helper.h"
 #include "Urysohn.h"
 #include "Layer.h"
 #include "KANKAN.h"
+#include "DistributedTrainer.h"
+#include "TcpTransport.h"
+#include "SharedMemoryTransport.h"
+#include "OnlineTrainer.h"
+#include "PredictionSession.h"
+#include "CsvLoader.h"
+#include "Prefetcher.h"
+#include "ResidualSampler.h"
+#include "EpochValidator.h"
+#include "ModelRegistry.h"
 
 ///////////// Determinat dataset
 std::unique_ptr<std::unique_ptr<double[]>[]> GenerateInput(int nRecords, int nFeatures, double min, double max) {
@@ -232,8 +245,8 @@ void Det_4_4() {
 	int nU1 = 1;
 
 	//instantiation of layers
-	auto layer0 = std::make_unique<Layer>(nU0, nFeatures, argmin, argmax, 3);
-	auto layer1 = std::make_unique<Layer>(nU1, nU0, 30);
+	auto layer0 = std::make_unique<Layer<>>(nU0, nFeatures, argmin, argmax, 3);
+	auto layer1 = std::make_unique<Layer<>>(nU1, nU0, 30);
 
 	//auxiliary data buffers for a quick moving data between methods
 	auto models0 = std::make_unique<double[]>(nU0);
@@ -319,9 +332,9 @@ void Tetrahedron() {
 	int nU1 = 10;
 	int nU2 = nTargets;
 
-	auto layer0 = std::make_unique<Layer>(nU0, nFeatures, argmin, argmax, 2);
-	auto layer1 = std::make_unique<Layer>(nU1, nU0, 12);
-	auto layer2 = std::make_unique<Layer>(nU2, nU1, 22);
+	auto layer0 = std::make_unique<Layer<>>(nU0, nFeatures, argmin, argmax, 2);
+	auto layer1 = std::make_unique<Layer<>>(nU1, nU0, 12);
+	auto layer2 = std::make_unique<Layer<>>(nU2, nU1, 22);
 
 	auto models0 = std::make_unique<double[]>(nU0);
 	auto models1 = std::make_unique<double[]>(nU1);
@@ -457,18 +470,12 @@ void Medians() {
 	alpha.push_back(0.005);
 
 	//Wrapper class needed for encapsulation of all details, we pass network configuration only
-	auto kankan = std::make_unique<KANKAN>(U, P, argmin, argmax, alpha);
+	auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
 
-	//auxiliary data buffers for accuracy assessment
-	auto predicted_target = std::make_unique<double[]>(nTargets);
-
-	auto actual0 = std::make_unique<double[]>(nValidationRecords);
-	auto actual1 = std::make_unique<double[]>(nValidationRecords);
-	auto actual2 = std::make_unique<double[]>(nValidationRecords);
-
-	auto computed0 = std::make_unique<double[]>(nValidationRecords);
-	auto computed1 = std::make_unique<double[]>(nValidationRecords);
-	auto computed2 = std::make_unique<double[]>(nValidationRecords);
+	//accuracy is assessed on copies of the model by validation thread while training goes on
+	EpochValidator<> validator(features_validation, targets_validation, nValidationRecords, nTargets, 1, 2);
+	EpochValidator<>::Result result;
+	bool accurate = false;
 
 	printf("Training medians of random triangles\n");
 	for (int epoch = 0; epoch < 128; ++epoch) {
@@ -476,39 +483,17 @@ void Medians() {
 			kankan->Train(features_training[i], targets_training[i]);
 		}
 
-		double error = 0.0;
-		for (int i = 0; i < nValidationRecords; ++i) {
-			kankan->Predict(features_validation[i], predicted_target);
-
-			//data for accuracy assessment
-			for (int j = 0; j < nTargets; ++j) {
-				double err = targets_validation[i][j] - predicted_target[j];
-				error += err * err;
-			}
-
-			actual0[i] = targets_validation[i][0];
-			actual1[i] = targets_validation[i][1];
-			actual2[i] = targets_validation[i][2];
-
-			computed0[i] = predicted_target[0];
-			computed1[i] = predicted_target[1];
-			computed2[i] = predicted_target[2];
+		//results of previous epochs, pearsons for correlated targets
+		validator.Submit(*kankan, epoch);
+		while (validator.Poll(result)) {
+			current_time = clock();
+			printf("Epoch %d, RMSE %f, Pearsons: %f %f %f, time %2.3f\n", result.epoch, result.rmse, result.pearsons[0],
+				result.pearsons[1], result.pearsons[2], (double)(current_time - start_application) / CLOCKS_PER_SEC);
+			if (result.pearsons[0] > 0.985 && result.pearsons[1] > 0.985 && result.pearsons[2] > 0.985) accurate = true;
 		}
-		//pearsons for correlated targets
-		double p1 = Helper::Pearson(computed0, actual0, nValidationRecords);
-		double p2 = Helper::Pearson(computed1, actual1, nValidationRecords);
-		double p3 = Helper::Pearson(computed2, actual2, nValidationRecords);
-
-		//mean error
-		error /= nTargets;
-		error /= nValidationRecords;
-		error = sqrt(error);
-		current_time = clock();
-		printf("Epoch %d, RMSE %f, Pearsons: %f %f %f, time %2.3f\n", epoch, error, p1, p2, p3,
-			(double)(current_time - start_application) / CLOCKS_PER_SEC);
-
-		if (p1 > 0.985 && p2 > 0.985 && p3 > 0.985) break;
+		if (accurate) break;
 	}
+	validator.ShowStatistics();
 	printf("\n");
 }
 
@@ -555,14 +540,12 @@ void AreasOfTriangles() {
 	alpha.push_back(0.005);
 
 	//Wrapper class needed for encapsulation of all details, we pass network configuration only
-	auto kankan = std::make_unique<KANKAN>(U, P, argmin, argmax, alpha);
+	auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
 
-	//auxiliary data buffers for accuracy assessment
-	auto predicted_target = std::make_unique<double[]>(nTargets);
-
-	auto actual0 = std::make_unique<double[]>(nValidationRecords);
-
-	auto computed0 = std::make_unique<double[]>(nValidationRecords);
+	//accuracy is assessed on copies of the model by validation thread while training goes on
+	EpochValidator<> validator(features_validation, targets_validation, nValidationRecords, nTargets, 1, 2);
+	EpochValidator<>::Result result;
+	bool accurate = false;
 
 	printf("Training areas of random triangles\n");
 	for (int epoch = 0; epoch < 128; ++epoch) {
@@ -570,39 +553,952 @@ void AreasOfTriangles() {
 			kankan->Train(features_training[i], targets_training[i]);
 		}
 
+		//results of previous epochs
+		validator.Submit(*kankan, epoch);
+		while (validator.Poll(result)) {
+			current_time = clock();
+			printf("Epoch %d, RMSE %f, Pearson: %f, time %2.3f\n", result.epoch, result.rmse, result.pearsons[0],
+				(double)(current_time - start_application) / CLOCKS_PER_SEC);
+			if (result.pearsons[0] > 0.985) accurate = true;
+		}
+		if (accurate) break;
+	}
+	validator.ShowStatistics();
+	printf("\n");
+}
+
+//Data parallel version of Medians, started as a separate process for each rank
+void MediansDistributed(Transport& transport) {
+	int nTrainingRecords = 10000 / transport.GetSize();
+	int nValidationRecords = 2000;
+	int nFeatures = 6;
+	int nTargets = 3;
+	auto features_training = GenerateInputsMedians(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = GenerateInputsMedians(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeTargetsMedians(features_training, nTrainingRecords);
+	auto targets_validation = ComputeTargetsMedians(features_validation, nValidationRecords);
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+
+	std::vector<int> U = { 20, 10, 4, nTargets };
+	std::vector<int> P = { 2, 12, 12, 22 };
+	std::vector<double> alpha = { 0.1, 0.1, 0.1, 0.005 };
+	auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
+
+	//replicas are averaged after each 1000 records
+	DistributedTrainer<> trainer(*kankan, transport, 1000);
+
+	auto predicted_target = std::make_unique<double[]>(nTargets);
+	auto actual = std::make_unique<double[]>(nValidationRecords);
+	auto computed = std::make_unique<double[]>(nValidationRecords);
+
+	if (transport.GetRank() == 0) printf("Training medians of random triangles on %d processes\n", transport.GetSize());
+	for (int epoch = 0; epoch < 128; ++epoch) {
+		trainer.TrainEpoch(features_training, targets_training, nTrainingRecords);
+
+		//replicas are identical after synchronization, each rank validates on its own data
 		double error = 0.0;
 		for (int i = 0; i < nValidationRecords; ++i) {
 			kankan->Predict(features_validation[i], predicted_target);
-
-			//data for accuracy assessment
 			for (int j = 0; j < nTargets; ++j) {
 				double err = targets_validation[i][j] - predicted_target[j];
 				error += err * err;
 			}
+			actual[i] = targets_validation[i][0];
+			computed[i] = predicted_target[0];
+		}
+		double p1 = Helper::Pearson(computed, actual, nValidationRecords);
+		error /= nTargets;
+		error /= nValidationRecords;
+		error = sqrt(error);
 
-			actual0[i] = targets_validation[i][0];
+		//stop decision of rank 0 is shared with others
+		std::vector<double> stop(1, (p1 > 0.985) ? 1.0 : 0.0);
+		if (transport.GetRank() != 0) stop[0] = 0.0;
+		transport.AllReduce(stop, ReduceOperation::Max);
+		if (transport.GetRank() == 0) printf("Epoch %d, RMSE %f, Pearson: %f\n", epoch, error, p1);
+		if (stop[0] > 0.0) break;
+	}
+	trainer.ShowStatistics();
+}
+
+//Same demo in single precision, sums of functions are accumulated in double
+void AreasOfTrianglesFloat() {
+	int nFeatures = 6;
+	int nTargets = 1;
+	int nTrainingRecords = 10000;
+	int nValidationRecords = 2000;
+	auto features_training_double = MakeRandomMatrixForTriangles(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation_double = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training_double = ComputeAreasOfTriangles(features_training_double, nTrainingRecords);
+	auto targets_validation_double = ComputeAreasOfTriangles(features_validation_double, nValidationRecords);
+	auto features_training = Helper::Convert<float>(features_training_double, nTrainingRecords, nFeatures);
+	auto features_validation = Helper::Convert<float>(features_validation_double, nValidationRecords, nFeatures);
+	auto targets_training = Helper::Convert<float>(targets_training_double, nTrainingRecords, nTargets);
+	auto targets_validation = Helper::Convert<float>(targets_validation_double, nValidationRecords, nTargets);
+
+	clock_t start_application = clock();
+	clock_t current_time = clock();
 
+	std::vector<float> argmin;
+	std::vector<float> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+
+	std::vector<int> U = { 50, 8, 4, nTargets };
+	std::vector<int> P = { 2, 12, 12, 22 };
+	std::vector<float> alpha = { 0.1f, 0.01f, 0.01f, 0.005f };
+	auto kankan = std::make_unique<KANKAN<float, double>>(U, P, argmin, argmax, alpha);
+
+	auto predicted_target = std::make_unique<float[]>(nTargets);
+	auto actual0 = std::make_unique<float[]>(nValidationRecords);
+	auto computed0 = std::make_unique<float[]>(nValidationRecords);
+
+	printf("Training areas of random triangles in single precision\n");
+	for (int epoch = 0; epoch < 128; ++epoch) {
+		for (int i = 0; i < nTrainingRecords; ++i) {
+			kankan->Train(features_training[i], targets_training[i]);
+		}
+
+		double error = 0.0;
+		for (int i = 0; i < nValidationRecords; ++i) {
+			kankan->Predict(features_validation[i], predicted_target);
+			double err = targets_validation[i][0] - predicted_target[0];
+			error += err * err;
+			actual0[i] = targets_validation[i][0];
 			computed0[i] = predicted_target[0];
 		}
-		//pearsons for correlated targets
 		double p1 = Helper::Pearson(computed0, actual0, nValidationRecords);
-
-		//mean error
-		error /= nTargets;
-		error /= nValidationRecords;
-		error = sqrt(error);
+		error = sqrt(error / nValidationRecords);
 		current_time = clock();
-		printf("Epoch %d, RMSE %f, Pearson: %f, time %2.3f\n", epoch, error, p1, 
+		printf("Epoch %d, RMSE %f, Pearson: %f, time %2.3f\n", epoch, error, p1,
 			(double)(current_time - start_application) / CLOCKS_PER_SEC);
 
 		if (p1 > 0.985) break;
 	}
 	printf("\n");
 }
+//Sparse features, few of many features are nonzero in each record, the target is sum of functions of them
+void MakeSparseRecords(int nRecords, int nFeatures, int nNonZeros, std::vector<SparseInput<double>>& features,
+	std::unique_ptr<std::unique_ptr<double[]>[]>& dense, std::unique_ptr<std::unique_ptr<double[]>[]>& targets) {
+	features = std::vector<SparseInput<double>>(nRecords);
+	dense = std::make_unique<std::unique_ptr<double[]>[]>(nRecords);
+	targets = std::make_unique<std::unique_ptr<double[]>[]>(nRecords);
+	for (int i = 0; i < nRecords; ++i) {
+		dense[i] = std::make_unique<double[]>(nFeatures);
+		targets[i] = std::make_unique<double[]>(1);
+		double target = 0.0;
+		while (features[i].Size() < nNonZeros) {
+			int j = rand() % nFeatures;
+			if (dense[i][j] != 0.0) continue;
+			double x = (rand() % 999 + 1) / 1000.0;
+			dense[i][j] = x;
+			features[i].Add(j, x);
+			target += sin(3.0 * x + j % 7) * (j % 5 == 0 ? 1.0 : 0.2);
+		}
+		targets[i][0] = target;
+	}
+}
+void SparseFeatures() {
+	int nFeatures = 300;
+	int nNonZeros = 8;
+	int nTrainingRecords = 20000;
+	int nValidationRecords = 2000;
+	std::vector<SparseInput<double>> features_training;
+	std::vector<SparseInput<double>> features_validation;
+	std::unique_ptr<std::unique_ptr<double[]>[]> dense_training;
+	std::unique_ptr<std::unique_ptr<double[]>[]> dense_validation;
+	std::unique_ptr<std::unique_ptr<double[]>[]> targets_training;
+	std::unique_ptr<std::unique_ptr<double[]>[]> targets_validation;
+	MakeSparseRecords(nTrainingRecords, nFeatures, nNonZeros, features_training, dense_training, targets_training);
+	MakeSparseRecords(nValidationRecords, nFeatures, nNonZeros, features_validation, dense_validation, targets_validation);
+
+	//zero must be inside limits, it is the value of missing features
+	std::vector<double> argmin(nFeatures, 0.0);
+	std::vector<double> argmax(nFeatures, 1.0);
+	std::vector<int> U = { 8, 1 };
+	std::vector<int> P = { 3, 6 };
+	std::vector<double> alpha = { 0.1, 0.05 };
+	auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
+
+	auto predicted_target = std::make_unique<double[]>(1);
+	auto actual0 = std::make_unique<double[]>(nValidationRecords);
+	auto computed0 = std::make_unique<double[]>(nValidationRecords);
+
+	printf("Training sum of functions of %d sparse features of %d\n", nNonZeros, nFeatures);
+	clock_t start_application = clock();
+	for (int epoch = 0; epoch < 16; ++epoch) {
+		for (int i = 0; i < nTrainingRecords; ++i) {
+			kankan->Train(features_training[i], targets_training[i]);
+		}
+		double error = 0.0;
+		for (int i = 0; i < nValidationRecords; ++i) {
+			kankan->Predict(features_validation[i], predicted_target);
+			double err = targets_validation[i][0] - predicted_target[0];
+			error += err * err;
+			actual0[i] = targets_validation[i][0];
+			computed0[i] = predicted_target[0];
+		}
+		double p1 = Helper::Pearson(computed0, actual0, nValidationRecords);
+		error = sqrt(error / nValidationRecords);
+		printf("Epoch %d, RMSE %f, Pearson: %f, time %2.3f\n", epoch, error, p1,
+			(double)(clock() - start_application) / CLOCKS_PER_SEC);
+		if (p1 > 0.85) break;
+	}
+	//same model evaluated with all features
+	clock_t start_sparse = clock();
+	for (int i = 0; i < nValidationRecords; ++i) {
+		kankan->Predict(features_validation[i], predicted_target);
+	}
+	clock_t start_dense = clock();
+	double difference = 0.0;
+	for (int i = 0; i < nValidationRecords; ++i) {
+		kankan->Predict(dense_validation[i], predicted_target);
+		difference = std::max(difference, std::abs(predicted_target[0] - computed0[i]));
+	}
+	clock_t end = clock();
+	printf("Prediction time sparse %2.3f, dense %2.3f, max difference %e\n\n", (double)(start_dense - start_sparse) / CLOCKS_PER_SEC,
+		(double)(end - start_dense) / CLOCKS_PER_SEC, difference);
+}
+//Queries where each differs from previous one in few features, predictions of session are compared with full ones
+void IncrementalPredictions() {
+	int nFeatures = 200;
+	int nTrainingRecords = 5000;
+	int nQueries = 20000;
+	int nChanges = 3;
+	auto features = GenerateInput(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto targets = std::make_unique<std::unique_ptr<double[]>[]>(nTrainingRecords);
+	for (int i = 0; i < nTrainingRecords; ++i) {
+		targets[i] = std::make_unique<double[]>(1);
+		targets[i][0] = 0.0;
+		for (int j = 0; j < nFeatures; ++j) {
+			targets[i][0] += sin(3.0 * features[i][j] + j) / nFeatures;
+		}
+	}
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features, nTrainingRecords, nFeatures);
+	std::vector<int> U = { 20, 8, 1 };
+	std::vector<int> P = { 4, 6, 6 };
+	std::vector<double> alpha = { 0.01, 0.01, 0.01 };
+	auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
+	for (int epoch = 0; epoch < 2; ++epoch) {
+		for (int i = 0; i < nTrainingRecords; ++i) {
+			kankan->Train(features[i], targets[i]);
+		}
+	}
+
+	auto queries = GenerateInput(nQueries, nFeatures, 0.0, 1.0);
+	for (int q = 1; q < nQueries; ++q) {
+		for (int j = 0; j < nFeatures; ++j) {
+			queries[q][j] = queries[q - 1][j];
+		}
+		for (int n = 0; n < nChanges; ++n) {
+			queries[q][rand() % nFeatures] = (rand() % 1000) / 1000.0;
+		}
+	}
+	auto predicted = std::make_unique<double[]>(nQueries);
+	auto output = std::make_unique<double[]>(1);
+	printf("Predictions of %d queries changing %d of %d features\n", nQueries, nChanges, nFeatures);
+	clock_t start = clock();
+	for (int q = 0; q < nQueries; ++q) {
+		kankan->Predict(queries[q], output);
+		predicted[q] = output[0];
+	}
+	clock_t middle = clock();
+	PredictionSession<> session(*kankan);
+	double difference = 0.0;
+	for (int q = 0; q < nQueries; ++q) {
+		session.Predict(queries[q], output);
+		difference = std::max(difference, std::abs(output[0] - predicted[q]));
+	}
+	clock_t end = clock();
+	long long incremental;
+	long long full;
+	session.GetCounters(incremental, full);
+	printf("Time full %2.3f, session %2.3f, inputs evaluated by increments %lld, in full %lld, max difference %e\n\n",
+		(double)(middle - start) / CLOCKS_PER_SEC, (double)(end - middle) / CLOCKS_PER_SEC, incremental, full, difference);
+}
+//Trains the same network record by record and by blocks until Pearsons of all targets reach the goal,
+//epochs and time of both methods are printed
+void EpochsToTarget(const char* name, const std::vector<int>& U, const std::vector<int>& P, const std::vector<double>& alpha,
+	std::unique_ptr<std::unique_ptr<double[]>[]>& features_training, std::unique_ptr<std::unique_ptr<double[]>[]>& targets_training,
+	int nTrainingRecords, std::unique_ptr<std::unique_ptr<double[]>[]>& features_validation,
+	std::unique_ptr<std::unique_ptr<double[]>[]>& targets_validation, int nValidationRecords, int nFeatures,
+	double goal, int maxEpochs) {
+	const int blockSize = 8;
+	int nTargets = U[U.size() - 1];
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	auto predicted = std::make_unique<double[]>(nTargets);
+	auto actual = std::make_unique<double[]>(nValidationRecords);
+	auto computed = std::make_unique<double[]>(nValidationRecords);
+	unsigned int seed = (unsigned int)rand();
+	for (int method = 0; method < 2; ++method) {
+		srand(seed);
+		auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
+		clock_t start = clock();
+		int epoch = 0;
+		double pearson = 0.0;
+		while (epoch < maxEpochs && pearson < goal) {
+			if (method == 0) {
+				for (int i = 0; i < nTrainingRecords; ++i) {
+					kankan->Train(features_training[i], targets_training[i]);
+				}
+			}
+			else {
+				for (int i = 0; i + blockSize <= nTrainingRecords; i += blockSize) {
+					kankan->TrainBlock(features_training, targets_training, i, blockSize);
+				}
+			}
+			++epoch;
+			pearson = 1.0;
+			for (int j = 0; j < nTargets; ++j) {
+				for (int i = 0; i < nValidationRecords; ++i) {
+					kankan->Predict(features_validation[i], predicted);
+					actual[i] = targets_validation[i][j];
+					computed[i] = predicted[j];
+				}
+				pearson = std::min(pearson, Helper::Pearson(computed, actual, nValidationRecords));
+			}
+		}
+		printf("%-12s %-7s epochs %3d, time %7.2f s, Pearson %f\n", name, method == 0 ? "record" : "block",
+			epoch, (double)(clock() - start) / CLOCKS_PER_SEC, pearson);
+	}
+}
+//Record by record Newton-Kaczmarz against block Newton-Kaczmarz with adaptive steps on the four demo tasks.
+//Runs for about 15 minutes, determinants and tetrahedron take most of it.
+void CompareTrainingMethods() {
+	{
+		int nTrainingRecords = 100000;
+		int nValidationRecords = 20000;
+		auto features_training = GenerateInput(nTrainingRecords, 16, 0.0, 1.0);
+		auto features_validation = GenerateInput(nValidationRecords, 16, 0.0, 1.0);
+		auto determinants_training = ComputeDeterminantTarget(features_training, 4, nTrainingRecords);
+		auto determinants_validation = ComputeDeterminantTarget(features_validation, 4, nValidationRecords);
+		double targetMin = Helper::Min(determinants_training, nTrainingRecords);
+		double targetMax = Helper::Max(determinants_training, nTrainingRecords);
+		auto targets_training = std::make_unique<std::unique_ptr<double[]>[]>(nTrainingRecords);
+		for (int i = 0; i < nTrainingRecords; ++i) {
+			targets_training[i] = std::make_unique<double[]>(1);
+			targets_training[i][0] = (determinants_training[i] - targetMin) / (targetMax - targetMin);
+		}
+		auto targets_validation = std::make_unique<std::unique_ptr<double[]>[]>(nValidationRecords);
+		for (int i = 0; i < nValidationRecords; ++i) {
+			targets_validation[i] = std::make_unique<double[]>(1);
+			targets_validation[i][0] = (determinants_validation[i] - targetMin) / (targetMax - targetMin);
+		}
+		EpochsToTarget("Determinants", { 50, 1 }, { 3, 30 }, { 1.0, 0.005 }, features_training, targets_training, nTrainingRecords,
+			features_validation, targets_validation, nValidationRecords, 16, 0.975, 32);
+	}
+	{
+		int nTrainingRecords = 10000;
+		int nValidationRecords = 2000;
+		auto features_training = MakeRandomMatrixForTriangles(nTrainingRecords, 6, 0.0, 1.0);
+		auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, 6, 0.0, 1.0);
+		auto targets_training = ComputeAreasOfTriangles(features_training, nTrainingRecords);
+		auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
+		EpochsToTarget("Areas", { 50, 8, 4, 1 }, { 2, 12, 12, 22 }, { 0.1, 0.01, 0.01, 0.005 }, features_training, targets_training,
+			nTrainingRecords, features_validation, targets_validation, nValidationRecords, 6, 0.985, 32);
+	}
+	{
+		int nTrainingRecords = 10000;
+		int nValidationRecords = 2000;
+		auto features_training = GenerateInputsMedians(nTrainingRecords, 6, 0.0, 1.0);
+		auto features_validation = GenerateInputsMedians(nValidationRecords, 6, 0.0, 1.0);
+		auto targets_training = ComputeTargetsMedians(features_training, nTrainingRecords);
+		auto targets_validation = ComputeTargetsMedians(features_validation, nValidationRecords);
+		EpochsToTarget("Medians", { 20, 10, 4, 3 }, { 2, 12, 12, 22 }, { 0.1, 0.1, 0.1, 0.005 }, features_training, targets_training,
+			nTrainingRecords, features_validation, targets_validation, nValidationRecords, 6, 0.985, 32);
+	}
+	{
+		int nTrainingRecords = 500000;
+		int nValidationRecords = 50000;
+		auto features_training = MakeRandomMatrix(nTrainingRecords, 12, 0.0, 1.0);
+		auto features_validation = MakeRandomMatrix(nValidationRecords, 12, 0.0, 1.0);
+		auto targets_training = ComputeTargetMatrix(features_training, nTrainingRecords);
+		auto targets_validation = ComputeTargetMatrix(features_validation, nValidationRecords);
+		EpochsToTarget("Tetrahedron", { 50, 10, 4 }, { 2, 12, 22 }, { 0.1, 0.1, 0.005 }, features_training, targets_training,
+			nTrainingRecords, features_validation, targets_validation, nValidationRecords, 12, 0.98, 32);
+	}
+}
+//Producer for online demo, writes records of random triangles to standard output
+void FeedTriangles(int nRecords) {
+	RecordStream::SetBinaryMode();
+	int nFeatures = 6;
+	auto features = MakeRandomMatrixForTriangles(nRecords, nFeatures, 0.0, 1.0);
+	auto targets = ComputeAreasOfTriangles(features, nRecords);
+	RecordStream::WriteHeader(std::cout, sizeof(double), nFeatures, 1);
+	for (int i = 0; i < nRecords; ++i) {
+		RecordStream::WriteRecord(std::cout, features[i], nFeatures, targets[i], 1);
+	}
+	std::cout.flush();
+}
+//Online training from stream, predictions are served from snapshots by separate thread
+//Areas of random triangles written as CSV, six coordinates and area in each line
+void WriteTriangles(const char* fileName, int nRecords) {
+	int nFeatures = 6;
+	auto features = MakeRandomMatrixForTriangles(nRecords, nFeatures, 0.0, 1.0);
+	auto targets = ComputeAreasOfTriangles(features, nRecords);
+	std::ofstream stream(fileName);
+	stream.precision(17);
+	for (int i = 0; i < nRecords; ++i) {
+		for (int j = 0; j < nFeatures; ++j) {
+			stream << features[i][j] << ',';
+		}
+		stream << targets[i][0] << '\n';
+	}
+}
+//Training on records of CSV or TSV file, last nTargets columns are targets, last fifth of records is validation
+void TrainFromFile(const char* fileName, int nTargets) {
+	std::string name = fileName;
+	char delimiter = (name.size() > 4 && name.substr(name.size() - 4) == ".tsv") ? '\t' : ',';
+	clock_t start_application = clock();
+	CsvLoader<> loader(name, nTargets, delimiter);
+	int nRecords = loader.GetNumberOfRecords();
+	int nFeatures = loader.GetNumberOfFeatures();
+	auto& features = loader.GetFeatures();
+	auto& targets = loader.GetTargets();
+	printf("Loaded %d records of %d features and %d targets, time %2.3f\n", nRecords, nFeatures, nTargets,
+		(double)(clock() - start_application) / CLOCKS_PER_SEC);
+	int nValidationRecords = nRecords / 5;
+	int nTrainingRecords = nRecords - nValidationRecords;
+	if (nValidationRecords < 1) {
+		printf("Fatal: too few records\n");
+		exit(0);
+	}
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	loader.GetFeatureLimits(argmin, argmax);
+	std::vector<int> U = { 8 * nFeatures, 8, 4, nTargets };
+	std::vector<int> P = { 2, 12, 12, 22 };
+	std::vector<double> alpha = { 0.1, 0.01, 0.01, 0.005 };
+	auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
+
+	auto validation_features = std::make_unique<std::unique_ptr<double[]>[]>(nValidationRecords);
+	auto validation_targets = std::make_unique<std::unique_ptr<double[]>[]>(nValidationRecords);
+	for (int i = 0; i < nValidationRecords; ++i) {
+		validation_features[i] = std::move(features[nTrainingRecords + i]);
+		validation_targets[i] = std::move(targets[nTrainingRecords + i]);
+	}
+	for (int epoch = 0; epoch < 32; ++epoch) {
+		for (int i = 0; i < nTrainingRecords; ++i) {
+			kankan->Train(features[i], targets[i]);
+		}
+		double error = kankan->ComputeRMSE(validation_features, validation_targets, nValidationRecords);
+		printf("Epoch %d, RMSE %f, time %2.3f\n", epoch, error, (double)(clock() - start_application) / CLOCKS_PER_SEC);
+	}
+	printf("\n");
+}
+//Areas of triangles, shuffling and copying of records run on producer threads, trainer takes ready blocks
+void PrefetchedTriangles() {
+	int nFeatures = 6;
+	int nTrainingRecords = 10000;
+	int nValidationRecords = 2000;
+	int nEpochs = 32;
+	auto features_training = MakeRandomMatrixForTriangles(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeAreasOfTriangles(features_training, nTrainingRecords);
+	auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	std::vector<int> U = { 50, 8, 4, 1 };
+	std::vector<int> P = { 2, 12, 12, 22 };
+	std::vector<double> alpha = { 0.1, 0.01, 0.01, 0.005 };
+	auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
+
+	MatrixSource<> source(features_training, targets_training, nTrainingRecords, nFeatures, 1, nEpochs, 1);
+	Prefetcher<> prefetcher(source, 2, 16, 256, nFeatures, 1);
+	printf("Training areas of random triangles from prefetched blocks\n");
+	clock_t start_application = clock();
+	int epoch = 0;
+	while (RecordBlock<>* block = prefetcher.Acquire()) {
+		if (block->epoch != epoch) {
+			double error = kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords);
+			printf("Epoch %d, RMSE %f, time %2.3f\n", epoch, error, (double)(clock() - start_application) / CLOCKS_PER_SEC);
+			epoch = block->epoch;
+		}
+		for (int i = 0; i < block->nRecords; ++i) {
+			kankan->Train(block->features[i], block->targets[i]);
+		}
+		prefetcher.Release(block);
+	}
+	double error = kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords);
+	printf("Epoch %d, RMSE %f, time %2.3f\n", epoch, error, (double)(clock() - start_application) / CLOCKS_PER_SEC);
+	prefetcher.ShowStatistics();
+	printf("\n");
+}
+//Areas of triangles, serving replicas follow the trained model by journals taken every interval of records.
+//Journals are shipped in binary form, their size is compared with a full copy of knots and limits. Each record
+//changes about a quarter of knots of this small network, so journals of 100 or 1000 records list about half
+//of the knots, changed knots are mostly in runs and journals take 40 to 50 percent of a full copy.
+void ReplicatedTriangles() {
+	int nFeatures = 6;
+	int nTrainingRecords = 10000;
+	int nValidationRecords = 2000;
+	int nReplicas = 3;
+	auto features_training = MakeRandomMatrixForTriangles(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeAreasOfTriangles(features_training, nTrainingRecords);
+	auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	std::vector<int> U = { 50, 8, 4, 1 };
+	std::vector<int> P = { 2, 12, 12, 22 };
+	std::vector<double> alpha = { 0.1, 0.01, 0.01, 0.005 };
+	auto initial = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
+	int nKnots = 0;
+	int nFunctions = 0;
+	for (int k = 0; k < initial->GetNumberOfLayers(); ++k) {
+		nKnots += initial->GetLayer(k).GetNumberOfKnots();
+		nFunctions += initial->GetLayer(k).GetNumberOfFunctions();
+	}
+	double copyBytes = nKnots * sizeof(double) + nFunctions * 2 * sizeof(double);
+
+	for (int interval : { 100, 1000 }) {
+		auto kankan = std::make_unique<KANKAN<>>(*initial);
+		kankan->EnableJournal(true);
+		std::vector<std::unique_ptr<KANKAN<>>> replicas;
+		for (int r = 0; r < nReplicas; ++r) {
+			replicas.push_back(std::make_unique<KANKAN<>>(*kankan));
+		}
+		printf("Training areas of random triangles, %d replicas follow journals of every %d records\n", nReplicas, interval);
+		ModelJournal journal;
+		ModelJournal received;
+		for (int epoch = 0; epoch < 4; ++epoch) {
+			long long journalKnots = 0;
+			long long journalBytes = 0;
+			int nJournals = 0;
+			for (int first = 0; first < nTrainingRecords; first += interval) {
+				for (int i = first; i < std::min(first + interval, nTrainingRecords); ++i) {
+					kankan->Train(features_training[i], targets_training[i]);
+				}
+				kankan->GetJournal(journal);
+				std::stringstream message;
+				journal.Write(message);
+				journalBytes += (long long)message.str().size();
+				journalKnots += journal.GetKnotList().size();
+				++nJournals;
+				if (!received.Read(message)) {
+					printf("Fatal: journal can not be read\n");
+					exit(0);
+				}
+				for (int r = 0; r < nReplicas; ++r) {
+					if (!replicas[r]->ApplyJournal(received)) {
+						replicas[r] = std::make_unique<KANKAN<>>(*kankan);
+					}
+				}
+			}
+			double error = kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords);
+			double difference = 0.0;
+			for (int r = 0; r < nReplicas; ++r) {
+				difference = std::max(difference, std::abs(replicas[r]->ComputeRMSE(features_validation, targets_validation, nValidationRecords) - error));
+			}
+			printf("Epoch %d, RMSE %f, journal %.0f of %d knots, %.0f bytes, %.1f%% of full copy, replica RMSE difference %e\n",
+				epoch, error, (double)journalKnots / nJournals, nKnots, (double)journalBytes / nJournals,
+				100.0 * journalBytes / nJournals / copyBytes, difference);
+		}
+	}
+	printf("\n");
+}
+//Areas of triangles trained with all records in each epoch and with skipping of well fitted records,
+//threshold follows validation error, both runs stop when the same error is reached
+void SampledTriangles() {
+	int nFeatures = 6;
+	int nTrainingRecords = 10000;
+	int nValidationRecords = 2000;
+	double goal = 0.007;
+	auto features_training = MakeRandomMatrixForTriangles(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeAreasOfTriangles(features_training, nTrainingRecords);
+	auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	std::vector<int> U = { 50, 8, 4, 1 };
+	std::vector<int> P = { 2, 12, 12, 22 };
+	std::vector<double> alpha = { 0.1, 0.01, 0.01, 0.005 };
+	for (int sampled = 0; sampled < 2; ++sampled) {
+		srand(1);
+		auto kankan = std::make_unique<KANKAN<>>(U, P, argmin, argmax, alpha);
+		//threshold zero and full revisits make plain epochs
+		ResidualSampler<> sampler(*kankan, nTrainingRecords, 0.0, 0.2, sampled ? 4 : 1, 1);
+		printf("Training areas of random triangles, %s\n", sampled ? "skipping well fitted records" : "all records");
+		for (int epoch = 0; epoch < 64; ++epoch) {
+			sampler.TrainEpoch(features_training, targets_training);
+			double error = kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords);
+			if (sampled) sampler.SetThreshold(0.3 * error);
+			printf("Epoch %d, RMSE %f, ", epoch, error);
+			sampler.ShowStatistics();
+			if (error < goal) break;
+		}
+		printf("\n");
+	}
+}
+//Areas of triangles, after training the targets drift and only outer layers are fine tuned from cached
+//outputs of the frozen first layer
+void FineTunedTriangles() {
+	int nFeatures = 6;
+	int nTrainingRecords = 10000;
+	int nValidationRecords = 2000;
+	auto features_training = MakeRandomMatrixForTriangles(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeAreasOfTriangles(features_training, nTrainingRecords);
+	auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	auto kankan = std::make_unique<KANKAN<>>(std::vector<int>{ 50, 8, 4, 1 }, std::vector<int>{ 2, 12, 12, 22 },
+		argmin, argmax, std::vector<double>{ 0.1, 0.01, 0.01, 0.005 });
+	printf("Training areas of random triangles\n");
+	for (int epoch = 0; epoch < 8; ++epoch) {
+		for (int i = 0; i < nTrainingRecords; ++i) {
+			kankan->Train(features_training[i], targets_training[i]);
+		}
+	}
+	printf("RMSE %f\n", kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords));
+
+	//new targets are nonlinear function of old ones, inner layers need no change
+	for (int i = 0; i < nTrainingRecords; ++i) {
+		targets_training[i][0] = 2.0 * targets_training[i][0] * targets_training[i][0] + 0.5 * targets_training[i][0];
+	}
+	for (int i = 0; i < nValidationRecords; ++i) {
+		targets_validation[i][0] = 2.0 * targets_validation[i][0] * targets_validation[i][0] + 0.5 * targets_validation[i][0];
+	}
+	printf("Targets drifted, RMSE %f\n", kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords));
+
+	clock_t start = clock();
+	ActivationCache<float> cache;
+	kankan->ComputeActivations(features_training, nTrainingRecords, 1, cache);
+	printf("Cache of first layer %.1f KB, time %2.3f\n", cache.GetBytes() / 1024.0, (double)(clock() - start) / CLOCKS_PER_SEC);
+	for (int epoch = 0; epoch < 6; ++epoch) {
+		for (int i = 0; i < nTrainingRecords; ++i) {
+			kankan->Train(cache, i, targets_training[i]);
+		}
+		printf("Fine tuning epoch %d, RMSE %f, time %2.3f\n", epoch,
+			kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords), (double)(clock() - start) / CLOCKS_PER_SEC);
+	}
+	printf("\n");
+}
+//Small model for each of many segments, segments have scaled areas of triangles as targets. Models are packed
+//and stored in temporary directory, requests are served through registry keeping a quarter of models resident.
+//Requests of segment of rank r are proportional to 1 / r^1.5 (Zipf law), about nine of ten requests find their
+//model in memory and the rest load it from file.
+void ServedSegments() {
+	int nSegments = 200;
+	int nFeatures = 6;
+	int nRecords = 1000;
+	auto features = MakeRandomMatrixForTriangles(nRecords, nFeatures, 0.0, 1.0);
+	auto areas = ComputeAreasOfTriangles(features, nRecords);
+	//targets of each segment are scaled areas, they are set in the loop of segments
+	auto targets = std::make_unique<std::unique_ptr<double[]>[]>(nRecords);
+	for (int i = 0; i < nRecords; ++i) {
+		targets[i] = std::make_unique<double[]>(1);
+	}
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features, nRecords, nFeatures);
+
+	std::string directory = (std::filesystem::temp_directory_path() / "KANKAN-3-models").string();
+	std::filesystem::create_directories(directory);
+	size_t packedBytes = 0;
+	double difference = 0.0;
+	auto expected = std::make_unique<double[]>(1);
+	auto actual = std::make_unique<double[]>(1);
+	std::vector<double> scratch;
+	ModelRegistry<> registry(directory, 0);
+	clock_t start = clock();
+	for (int s = 0; s < nSegments; ++s) {
+		for (int i = 0; i < nRecords; ++i) {
+			targets[i][0] = areas[i][0] * (0.5 + 0.005 * s);
+		}
+		KANKAN<> kankan({ 8, 4, 1 }, { 2, 8, 12 }, argmin, argmax, { 0.1, 0.01, 0.005 });
+		for (int epoch = 0; epoch < 4; ++epoch) {
+			for (int i = 0; i < nRecords; ++i) {
+				kankan.Train(features[i], targets[i]);
+			}
+		}
+		PackedModel<> packed;
+		kankan.Pack(packed);
+		packedBytes += packed.GetBytes();
+		for (int i = 0; i < 10; ++i) {
+			kankan.Predict(features[i], expected);
+			packed.Predict(features[i], actual, scratch);
+			difference = std::max(difference, std::abs(expected[0] - actual[0]));
+		}
+		if (!registry.Store("segment" + std::to_string(s), packed)) {
+			printf("Fatal: can not write models to %s\n", directory.c_str());
+			exit(0);
+		}
+	}
+	printf("%d segment models trained and stored, packed size %.1f KB each, largest difference to KANKAN %e, time %2.3f\n",
+		nSegments, packedBytes / 1024.0 / nSegments, difference, (double)(clock() - start) / CLOCKS_PER_SEC);
+
+	std::vector<double> popularity(nSegments);
+	double total = 0.0;
+	for (int s = 0; s < nSegments; ++s) {
+		total += pow(s + 1.0, -1.5);
+		popularity[s] = total;
+	}
+	ModelRegistry<> serving(directory, packedBytes / 4);
+	int nRequests = 200000;
+	start = clock();
+	for (int r = 0; r < nRequests; ++r) {
+		double u = total * (rand() % 10000) / 10000.0;
+		int s = std::min((int)(std::upper_bound(popularity.begin(), popularity.end(), u) - popularity.begin()), nSegments - 1);
+		if (!serving.Predict("segment" + std::to_string(s), features[r % nRecords], actual)) {
+			printf("Fatal: model of segment %d is missing\n", s);
+			exit(0);
+		}
+	}
+	printf("Served %d requests, time %2.3f\n", nRequests, (double)(clock() - start) / CLOCKS_PER_SEC);
+	serving.ShowStatistics();
+	printf("\n");
+}
+//Areas of triangles trained from features and from features binned on grids of the first layer, both
+//runs start from the same model
+void BinnedTriangles() {
+	int nFeatures = 6;
+	int nTrainingRecords = 100000;
+	int nValidationRecords = 10000;
+	auto features_training = MakeRandomMatrixForTriangles(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeAreasOfTriangles(features_training, nTrainingRecords);
+	auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
 
-int main() {
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	auto initial = std::make_unique<KANKAN<>>(std::vector<int>{ 50, 8, 4, 1 }, std::vector<int>{ 2, 12, 12, 22 },
+		argmin, argmax, std::vector<double>{ 0.1, 0.01, 0.01, 0.005 });
+	BinnedInputs<> bins(features_training, nTrainingRecords, nFeatures);
+	printf("Binned features %.1f KB, features %.1f KB\n", bins.GetBytes() / 1024.0,
+		(double)nTrainingRecords * nFeatures * sizeof(double) / 1024.0);
+	for (int binned = 0; binned < 2; ++binned) {
+		auto kankan = std::make_unique<KANKAN<>>(*initial);
+		printf("Training areas of random triangles from %s\n", binned ? "binned features" : "features");
+		clock_t start = clock();
+		for (int epoch = 0; epoch < 6; ++epoch) {
+			for (int i = 0; i < nTrainingRecords; ++i) {
+				if (binned) kankan->Train(bins, i, targets_training[i]);
+				else kankan->Train(features_training[i], targets_training[i]);
+			}
+			printf("Epoch %d, RMSE %f, time %2.3f\n", epoch, kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords),
+				(double)(clock() - start) / CLOCKS_PER_SEC);
+		}
+	}
+	printf("Features binned %d times\n\n", bins.GetNumberOfBinnings());
+}
+//Areas of triangles trained by deterministic mini batches, two runs with the same number of threads
+//from the same model give identical models
+void BatchedTriangles() {
+	int nFeatures = 6;
+	int nTrainingRecords = 10000;
+	int nValidationRecords = 2000;
+	int nThreads = 4;
+	int batch = 64;
+	auto features_training = MakeRandomMatrixForTriangles(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeAreasOfTriangles(features_training, nTrainingRecords);
+	auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	auto initial = std::make_unique<KANKAN<>>(std::vector<int>{ 50, 8, 4, 1 }, std::vector<int>{ 2, 12, 12, 22 },
+		argmin, argmax, std::vector<double>{ 0.1, 0.01, 0.01, 0.005 });
+	std::vector<std::unique_ptr<KANKAN<>>> runs;
+	for (int run = 0; run < 2; ++run) {
+		runs.push_back(std::make_unique<KANKAN<>>(*initial));
+		printf("Training areas of random triangles by batches of %d on %d threads, run %d\n", batch, nThreads, run);
+		clock_t start = clock();
+		for (int epoch = 0; epoch < 8; ++epoch) {
+			//step of twice the mean update of the batch
+			for (int i = 0; i < nTrainingRecords; i += batch) {
+				runs[run]->TrainBatch(features_training, targets_training, i, std::min(batch, nTrainingRecords - i), nThreads, 2.0);
+			}
+			printf("Epoch %d, RMSE %f, time %2.3f\n", epoch, runs[run]->ComputeRMSE(features_validation, targets_validation, nValidationRecords),
+				(double)(clock() - start) / CLOCKS_PER_SEC);
+		}
+	}
+	auto predicted0 = std::make_unique<double[]>(1);
+	auto predicted1 = std::make_unique<double[]>(1);
+	int nDifferent = 0;
+	for (int i = 0; i < nValidationRecords; ++i) {
+		runs[0]->Predict(features_validation[i], predicted0);
+		runs[1]->Predict(features_validation[i], predicted1);
+		if (predicted0[0] != predicted1[0]) ++nDifferent;
+	}
+	printf("Runs %s, %d of %d predictions differ\n\n", nDifferent == 0 ? "identical" : "differ", nDifferent, nValidationRecords);
+}
+//Medians of triangles trained with and without grids sized by telemetry, both runs start from the same model.
+//Segment counters of the first two epochs are used to resample functions, accuracy drops for one epoch after
+//regrid while resampled functions are trained
+void RegriddedMedians() {
+	int nTrainingRecords = 10000;
+	int nValidationRecords = 2000;
+	int nFeatures = 6;
+	int nTargets = 3;
+	auto features_training = GenerateInputsMedians(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = GenerateInputsMedians(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeTargetsMedians(features_training, nTrainingRecords);
+	auto targets_validation = ComputeTargetsMedians(features_validation, nValidationRecords);
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	auto initial = std::make_unique<KANKAN<>>(std::vector<int>{ 20, 10, 4, nTargets }, std::vector<int>{ 2, 12, 12, 22 },
+		argmin, argmax, std::vector<double>{ 0.1, 0.1, 0.1, 0.005 });
+	for (int regrid = 0; regrid < 2; ++regrid) {
+		auto kankan = std::make_unique<KANKAN<>>(*initial);
+		kankan->EnableTelemetry(regrid == 1);
+		printf("Training medians of random triangles %s\n", regrid ? "with regrid after epoch 1" : "on initial grids");
+		clock_t start = clock();
+		for (int epoch = 0; epoch < 16; ++epoch) {
+			for (int i = 0; i < nTrainingRecords; ++i) {
+				kankan->Train(features_training[i], targets_training[i]);
+			}
+			if (regrid && epoch == 1) {
+				kankan->ShowTelemetry();
+				kankan->Regrid(0.1);
+				kankan->EnableTelemetry(false);
+			}
+			printf("Epoch %d, RMSE %f, time %2.3f\n", epoch, kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords),
+				(double)(clock() - start) / CLOCKS_PER_SEC);
+		}
+	}
+	printf("\n");
+}
+//Areas of triangles, trained model is compacted for serving, constant and nearly linear functions and Urysohns
+//of little effect are replaced, knots and accuracy before and after are printed
+void CompactedTriangles() {
+	int nFeatures = 6;
+	int nTrainingRecords = 10000;
+	int nValidationRecords = 2000;
+	auto features_training = MakeRandomMatrixForTriangles(nTrainingRecords, nFeatures, 0.0, 1.0);
+	auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_training = ComputeAreasOfTriangles(features_training, nTrainingRecords);
+	auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
+
+	std::vector<double> argmin;
+	std::vector<double> argmax;
+	Helper::FindMinMaxMatrix(argmin, argmax, features_training, nTrainingRecords, nFeatures);
+	auto kankan = std::make_unique<KANKAN<>>(std::vector<int>{ 50, 8, 4, 1 }, std::vector<int>{ 2, 12, 12, 22 },
+		argmin, argmax, std::vector<double>{ 0.1, 0.01, 0.01, 0.005 });
+
+	printf("Training areas of random triangles for compaction\n");
+	clock_t start = clock();
+	for (int epoch = 0; epoch < 8; ++epoch) {
+		for (int i = 0; i < nTrainingRecords; ++i) {
+			kankan->Train(features_training[i], targets_training[i]);
+		}
+		printf("Epoch %d, RMSE %f, time %2.3f\n", epoch, kankan->ComputeRMSE(features_validation, targets_validation, nValidationRecords),
+			(double)(clock() - start) / CLOCKS_PER_SEC);
+	}
+
+	//tolerances are in units of targets
+	kankan->Compact(0.001, 0.001, 0.001, features_validation, targets_validation, nValidationRecords);
+	printf("\n");
+}
+void OnlineTriangles(RecordStream& stream) {
+	int nFeatures = 6;
+	int nValidationRecords = 2000;
+	auto features_validation = MakeRandomMatrixForTriangles(nValidationRecords, nFeatures, 0.0, 1.0);
+	auto targets_validation = ComputeAreasOfTriangles(features_validation, nValidationRecords);
+
+	std::vector<double> argmin(nFeatures, 0.0);
+	std::vector<double> argmax(nFeatures, 1.0);
+	auto kankan = std::make_unique<KANKAN<>>(std::vector<int>{ 50, 8, 4, 1 }, std::vector<int>{ 2, 12, 12, 22 },
+		argmin, argmax, std::vector<double>{ 0.1, 0.01, 0.01, 0.005 });
+
+	OnlineTrainer<> trainer(*kankan, 64, 100);
+	trainer.Start(stream);
+	std::thread server([&] {
+		auto predicted = std::make_unique<double[]>(1);
+		while (trainer.IsRunning()) {
+			double error = 0.0;
+			for (int i = 0; i < nValidationRecords; ++i) {
+				trainer.Predict(features_validation[i], predicted);
+				error += (targets_validation[i][0] - predicted[0]) * (targets_validation[i][0] - predicted[0]);
+			}
+			printf("Served %d predictions, RMSE %f\n", nValidationRecords, sqrt(error / nValidationRecords));
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+	});
+	while (trainer.IsRunning()) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		trainer.ShowStatistics();
+	}
+	server.join();
+	trainer.Wait();
+	printf("Final snapshot RMSE %f\n", trainer.GetSnapshot()->ComputeRMSE(features_validation, targets_validation, nValidationRecords));
+}
+int main(int argc, char* argv[]) {
 	srand((unsigned int)time(NULL));
 
+	//Online demo, records are streamed through pipe or socket, for example
+	//KANKAN-3 feed 1000000 | KANKAN-3 online
+	//socket listens on loopback unless local address is given, KANKAN-3 online port [address]
+	if (argc >= 3 && std::string(argv[1]) == "feed") {
+		FeedTriangles(atoi(argv[2]));
+		return 0;
+	}
+	//Training on data from file, KANKAN-3 csv data.csv nTargets, file of triangles is made by
+	//KANKAN-3 makecsv 100000 triangles.csv
+	if (argc >= 4 && std::string(argv[1]) == "makecsv") {
+		WriteTriangles(argv[3], atoi(argv[2]));
+		return 0;
+	}
+	if (argc >= 3 && std::string(argv[1]) == "csv") {
+		TrainFromFile(argv[2], (argc >= 4) ? atoi(argv[3]) : 1);
+		return 0;
+	}
+	//Comparison of training methods, KANKAN-3 compare
+	if (argc >= 2 && std::string(argv[1]) == "compare") {
+		CompareTrainingMethods();
+		return 0;
+	}
+	if (argc >= 2 && std::string(argv[1]) == "online") {
+		std::unique_ptr<RecordStream> stream;
+		if (argc >= 3) {
+			stream = std::make_unique<SocketRecordStream>(atoi(argv[2]), (argc >= 4) ? argv[3] : "127.0.0.1");
+		}
+		else {
+			RecordStream::SetBinaryMode();
+			stream = std::make_unique<PipeRecordStream>(std::cin);
+		}
+		OnlineTriangles(*stream);
+		return 0;
+	}
+
+	//Distributed demo, each process is started with its rank, for example
+	//KANKAN-3 shm 0 4 & KANKAN-3 shm 1 4 & KANKAN-3 shm 2 4 & KANKAN-3 shm 3 4
+	//KANKAN-3 tcp 0 2 & KANKAN-3 tcp 1 2
+	if (argc >= 4) {
+		std::string mode = argv[1];
+		int rank = atoi(argv[2]);
+		int size = atoi(argv[3]);
+		srand((unsigned int)time(NULL) + rank);
+		std::unique_ptr<Transport> transport;
+		if (mode == "tcp") {
+			transport = std::make_unique<TcpTransport>(rank, size, 25000);
+		}
+		else {
+			transport = std::make_unique<SharedMemoryTransport>("/KANKAN-3", rank, size, 1 << 16);
+		}
+		MediansDistributed(*transport);
+		return 0;
+	}
+
 	//This is stable reusable code. KANKAN has layers, layers have urysohns, each urysohn is sum of functions.
 	//Here I show the entire training methods which is called Newton-Kaczmarz method, published in 2021.
 	//Inputs and outputs not need to be exactly normalized, but should not be significantly larger than [0, 1].
@@ -612,6 +1508,42 @@ int main() {
 	//Areas of random triangles.
 	AreasOfTriangles();
 
+	//Same in single precision, models take half of memory.
+	//AreasOfTrianglesFloat();
+
+	//Trained model compacted for serving.
+	//CompactedTriangles();
+
+	//Many features, few of them nonzero in each record.
+	//SparseFeatures();
+
+	//Queries differing in few features, incremental prediction.
+	//IncrementalPredictions();
+
+	//Training from blocks prepared on producer threads.
+	//PrefetchedTriangles();
+
+	//Serving replicas updated by journals of changes.
+	//ReplicatedTriangles();
+
+	//Epochs skipping records with small residuals.
+	//SampledTriangles();
+
+	//Fine tuning of outer layers after drift of targets.
+	//FineTunedTriangles();
+
+	//Serving of many small models under memory budget.
+	//ServedSegments();
+
+	//Training from inputs binned on grids of the first layer.
+	//BinnedTriangles();
+
+	//Deterministic mini batches trained on several threads.
+	//BatchedTriangles();
+
+	//Grids of functions resized by segment telemetry.
+	//RegriddedMedians();
+
 	//Related targets, the medians of random triangles.
 	Medians();
 
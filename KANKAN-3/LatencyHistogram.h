@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//Counts of values in logarithmic buckets, memory is fixed however many values are added. There are
+//bucketsPerOctave buckets for each doubling starting at smallest, percentiles are accurate to the width
+//of a bucket, 16 buckets per octave give about 4%. Values below smallest go to the first bucket.
+class LatencyHistogram {
+public:
+	LatencyHistogram(double smallest = 0.01, int nOctaves = 36, int bucketsPerOctave = 16) {
+		_smallest = smallest;
+		_bucketsPerOctave = bucketsPerOctave;
+		_counts.assign(nOctaves * bucketsPerOctave, 0);
+	}
+	void Add(double value) {
+		int n = 0;
+		if (value > _smallest) {
+			n = std::min((int)(log2(value / _smallest) * _bucketsPerOctave), (int)_counts.size() - 1);
+		}
+		++_counts[n];
+		++_nValues;
+		_max = std::max(_max, value);
+	}
+	void Clear() {
+		std::fill(_counts.begin(), _counts.end(), 0);
+		_nValues = 0;
+		_max = 0.0;
+	}
+	long long GetNumberOfValues() const {
+		return _nValues;
+	}
+	double GetMax() const {
+		return _max;
+	}
+	//Geometric middle of the bucket holding the percentile, not above the largest value
+	double GetPercentile(double p) const {
+		if (_nValues == 0) return 0.0;
+		long long rank = std::min((long long)(p * _nValues), _nValues - 1);
+		long long count = 0;
+		int n = 0;
+		for (; n < (int)_counts.size() - 1; ++n) {
+			count += _counts[n];
+			if (count > rank) break;
+		}
+		return std::min(_smallest * exp2((n + 0.5) / _bucketsPerOctave), _max);
+	}
+private:
+	double _smallest;
+	int _bucketsPerOctave;
+	std::vector<long long> _counts;
+	long long _nValues = 0;
+	double _max = 0.0;
+};
@@ -4,66 +4,210 @@
 #include <algorithm>
 #include "Urysohn.h"
 
+template <typename T = double, typename A = T>
 class Layer {
 public:
-	Layer(int nUrysohns, int nFunctions, std::vector<double> xmin, std::vector<double> xmax, int nPoints) {
+	Layer(int nUrysohns, int nFunctions, std::vector<T> xmin, std::vector<T> xmax, int nPoints) {
 		if (xmin.size() != xmax.size() || xmin.size() != nFunctions) {
 			printf("Fatal: sizes of xmin, xmax or nFunctions mismatch\n");
 			exit(0);
 		}
 		for (int i = 0; i < nUrysohns; ++i) {
-			_urysohns.push_back(std::make_unique<Urysohn>(xmin, xmax, 0.0, 1.0, nPoints));
+			_urysohns.push_back(std::make_unique<Urysohn<T, A>>(xmin, xmax, T(0), T(1), nPoints));
 		}
 	}
 	Layer(int nUrysohns, int nFunctions, int nPoints) {
-		std::vector<double> xmin;
-		std::vector<double> xmax;
+		std::vector<T> xmin;
+		std::vector<T> xmax;
 		for (int i = 0; i < nFunctions; ++i) {
-			xmin.push_back(0.0);
-			xmax.push_back(1.0);
+			xmin.push_back(0);
+			xmax.push_back(1);
 		}
 		for (int i = 0; i < nUrysohns; ++i) {
-			_urysohns.push_back(std::make_unique<Urysohn>(xmin, xmax, 0.0, 1.0, nPoints));
+			_urysohns.push_back(std::make_unique<Urysohn<T, A>>(xmin, xmax, T(0), T(1), nPoints));
 		}
 	}
 	Layer(const Layer& layer) {
 		_urysohns.clear();
-		_urysohns = std::vector<std::unique_ptr<Urysohn>>(layer._urysohns.size());
+		_urysohns = std::vector<std::unique_ptr<Urysohn<T, A>>>(layer._urysohns.size());
 		for (int i = 0; i < layer._urysohns.size(); ++i) {
-			_urysohns[i] = std::make_unique<Urysohn>(*layer._urysohns[i]);
+			_urysohns[i] = std::make_unique<Urysohn<T, A>>(*layer._urysohns[i]);
 		}
 	}
-	void Input2Output(const std::unique_ptr<double[]>& input, std::unique_ptr<double[]>& output) {
+	void Input2Output(const std::unique_ptr<T[]>& input, std::unique_ptr<T[]>& output) const {
 		for (int i = 0; i < _urysohns.size(); ++i) {
 			output[i] = _urysohns[i]->GetUrysohn(input);
 		}
 	}
-	void Input2Output(const std::unique_ptr<double[]>& input, std::unique_ptr<double[]>& output,
-		std::unique_ptr<std::unique_ptr<double[]>[]>& derivatives) {
+	void Input2Output(const SparseInput<T>& input, std::unique_ptr<T[]>& output) const {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			output[i] = _urysohns[i]->GetUrysohn(input);
+		}
+	}
+	void Input2Output(const std::unique_ptr<T[]>& input, std::unique_ptr<T[]>& output,
+		std::unique_ptr<std::unique_ptr<T[]>[]>& derivatives) const {
 		for (int i = 0; i < _urysohns.size(); ++i) {
 			output[i] = _urysohns[i]->GetUrysohn(input, derivatives[i]);
 		}
 	}
-	void ComputeDeltas(const std::unique_ptr<std::unique_ptr<double[]>[]>& derivatives, const std::unique_ptr<double[]>& deltasIn,
-		std::unique_ptr<double[]>& deltasOut, int nRows, int nCols) {
-		std::fill(deltasOut.get(), deltasOut.get() + nRows, 0.0);
+	//Record i of binned inputs, input is the same record of features
+	void Input2Output(const std::unique_ptr<T[]>& input, const BinnedInputs<T>& bins, int i, std::unique_ptr<T[]>& output,
+		std::unique_ptr<std::unique_ptr<T[]>[]>& derivatives) const {
+		for (int u = 0; u < _urysohns.size(); ++u) {
+			output[u] = _urysohns[u]->GetUrysohn(input, bins.GetCells(i), bins.GetOffsets(i), bins.GetMatched(u), derivatives[u]);
+		}
+	}
+	//Moves sums of Urysohns by the change of terms of input j
+	void ChangeInput(int j, T from, T to, std::unique_ptr<A[]>& sums) const {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			sums[i] += static_cast<A>(_urysohns[i]->GetTerm(j, to)) - _urysohns[i]->GetTerm(j, from);
+		}
+	}
+	void ComputeDeltas(const std::unique_ptr<std::unique_ptr<T[]>[]>& derivatives, const std::unique_ptr<T[]>& deltasIn,
+		std::unique_ptr<T[]>& deltasOut, int nRows, int nCols) const {
 		for (int n = 0; n < nRows; ++n) {
+			A delta = 0;
 			for (int k = 0; k < nCols; ++k) {
-				deltasOut[n] += derivatives[k][n] * deltasIn[k];
+				delta += derivatives[k][n] * deltasIn[k];
 			}
+			deltasOut[n] = static_cast<T>(delta);
 		}
 	}
-	void Update(const std::unique_ptr<double[]>& input, const std::unique_ptr<double[]>& deltas, double mu) {
+	void Update(const std::unique_ptr<T[]>& input, const std::unique_ptr<T[]>& deltas, T mu) {
 		for (int i = 0; i < _urysohns.size(); ++i) {
 			_urysohns[i]->Update(deltas[i] * mu, input);
 		}
 	}
+	void Update(const std::unique_ptr<T[]>& input, const BinnedInputs<T>& bins, int i, const std::unique_ptr<T[]>& deltas, T mu) {
+		for (int u = 0; u < _urysohns.size(); ++u) {
+			_urysohns[u]->Update(deltas[u] * mu, input, bins.GetCells(i), bins.GetOffsets(i), bins.GetMatched(u));
+		}
+	}
+	void Update(const SparseInput<T>& input, const std::unique_ptr<T[]>& deltas, T mu) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->Update(deltas[i] * mu, input);
+		}
+	}
+	void Accumulate(const std::unique_ptr<T[]>& input, const std::unique_ptr<T[]>& deltas, T mu,
+		UpdateBuffer<A>& buffer, int& knotOffset, int& functionOffset) const {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->Accumulate(deltas[i] * mu, input, buffer, knotOffset, functionOffset);
+		}
+	}
+	void ApplyBuffer(const UpdateBuffer<A>& buffer, int& knotPosition, int& functionPosition,
+		int& knotOffset, int& functionOffset) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->ApplyBuffer(buffer, knotPosition, functionPosition, knotOffset, functionOffset);
+		}
+	}
+	int GetNumberOfKnots() const {
+		int n = 0;
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			n += _urysohns[i]->GetNumberOfKnots();
+		}
+		return n;
+	}
+	int GetNumberOfUrysohns() const {
+		return (int)_urysohns.size();
+	}
+	long long GetGridVersion(int i) const {
+		return _urysohns[i]->GetGridVersion();
+	}
+	bool GetGrid(int i, int k, T& xmin, T& xmax, T& invdeltax, int& points) const {
+		return _urysohns[i]->GetGrid(k, xmin, xmax, invdeltax, points);
+	}
+	int GetNumberOfFunctions() const {
+		int n = 0;
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			n += _urysohns[i]->GetNumberOfFunctions();
+		}
+		return n;
+	}
+	void GetKnots(std::vector<double>& knots) const {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->GetKnots(knots);
+		}
+	}
+	void SetKnots(const std::vector<double>& knots, int& position) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->SetKnots(knots, position);
+		}
+	}
+	void GetLimits(std::vector<double>& xmin, std::vector<double>& xmax) const {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->GetLimits(xmin, xmax);
+		}
+	}
+	void ResetLimits(const std::vector<double>& xmin, const std::vector<double>& xmax, int& position) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->ResetLimits(xmin, xmax, position);
+		}
+	}
+	void Compact(double constantTolerance, double linearTolerance, int& nConstants, int& nLines) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->Compact(constantTolerance, linearTolerance, nConstants, nLines);
+		}
+	}
+	//Largest variation of functions taking input j, it is the contribution of this input to the layer
+	T GetInputRange(int j) const {
+		T range = 0;
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			range = std::max(range, _urysohns[i]->GetFunctionRange(j));
+		}
+		return range;
+	}
+	void RemoveInput(int j) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->RemoveFunction(j);
+		}
+	}
+	void RemoveUrysohn(int i) {
+		_urysohns.erase(_urysohns.begin() + i);
+	}
+	void EnableTelemetry(bool enable) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->EnableTelemetry(enable);
+		}
+	}
+	void GetTelemetry(std::vector<FunctionTelemetry>& telemetry) const {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->GetTelemetry(telemetry);
+		}
+	}
+	void Regrid(const std::vector<int>& points) {
+		int position = 0;
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->Regrid(points, position);
+		}
+	}
+	void EnableJournal(bool enable) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->EnableJournal(enable);
+		}
+	}
+	void GetJournal(ModelJournal& journal, int& knotOffset, int& functionOffset) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->GetJournal(journal, knotOffset, functionOffset);
+		}
+	}
+	void ApplyJournal(const ModelJournal& journal, int& knotPosition, int& functionPosition, int& knotOffset, int& functionOffset) {
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->ApplyJournal(journal, knotPosition, functionPosition, knotOffset, functionOffset);
+		}
+	}
+	template <typename P>
+	void Pack(PackedModel<P>& packed) const {
+		packed.AddLayer((int)_urysohns.size());
+		for (int i = 0; i < _urysohns.size(); ++i) {
+			_urysohns[i]->Pack(packed);
+		}
+	}
 	void IncrementPoins() {
 		for (int i = 0; i < _urysohns.size(); ++i) {
 			_urysohns[i]->IncrementPoints();
 		}
 	}
 private:
-	std::vector<std::unique_ptr<Urysohn>> _urysohns;
+	std::vector<std::unique_ptr<Urysohn<T, A>>> _urysohns;
 };
 
@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+//Changes of a model since previous journal, new values of changed knots and new limits of functions whose grids
+//changed. Knots and functions are addressed by flat indexes over the whole network as in UpdateBuffer, every entry
+//is listed once with its last value. Full journal means that numbers of knots or functions changed, such change
+//is not listed and replica has to be replaced by a copy of the model. Journal carries numbers of knots and functions
+//of the model it was taken from, replica of another shape rejects it.
+//In binary form sorted knot indexes are written as runs of consecutive indexes, gap from the end of previous run
+//and length of run in variable length bytes, so an index takes a few bits when many knots change. Values are exact.
+class ModelJournal {
+public:
+	void Clear() {
+		_knots.clear();
+		_values.clear();
+		_functions.clear();
+		_xmin.clear();
+		_xmax.clear();
+		_full = false;
+		_nModelKnots = 0;
+		_nModelFunctions = 0;
+	}
+	void SetShape(int nKnots, int nFunctions) {
+		_nModelKnots = nKnots;
+		_nModelFunctions = nFunctions;
+	}
+	int GetNumberOfModelKnots() const {
+		return _nModelKnots;
+	}
+	int GetNumberOfModelFunctions() const {
+		return _nModelFunctions;
+	}
+	//Indexes are strictly ascending and inside the shape, so every entry is consumed by a model of this shape
+	bool IsConsistent() const {
+		for (int i = 0; i < (int)_knots.size(); ++i) {
+			if (_knots[i] < 0 || _knots[i] >= _nModelKnots || (i > 0 && _knots[i] <= _knots[i - 1])) return false;
+		}
+		for (int i = 0; i < (int)_functions.size(); ++i) {
+			if (_functions[i] < 0 || _functions[i] >= _nModelFunctions || (i > 0 && _functions[i] <= _functions[i - 1])) return false;
+		}
+		return true;
+	}
+	void AddKnot(int n, double value) {
+		_knots.push_back(n);
+		_values.push_back(value);
+	}
+	void AddLimits(int n, double xmin, double xmax) {
+		_functions.push_back(n);
+		_xmin.push_back(xmin);
+		_xmax.push_back(xmax);
+	}
+	void SetFull() {
+		_full = true;
+	}
+	bool IsFull() const {
+		return _full;
+	}
+	//Entries are sorted before applying, so they can be consumed Urysohn by Urysohn in one pass
+	void Sort() {
+		std::vector<int> order(_knots.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [this](int a, int b) { return _knots[a] < _knots[b]; });
+		Permute(_knots, order);
+		Permute(_values, order);
+		order.resize(_functions.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [this](int a, int b) { return _functions[a] < _functions[b]; });
+		Permute(_functions, order);
+		Permute(_xmin, order);
+		Permute(_xmax, order);
+	}
+	const std::vector<int>& GetKnotList() const {
+		return _knots;
+	}
+	const std::vector<int>& GetFunctionList() const {
+		return _functions;
+	}
+	double GetKnot(int position) const {
+		return _values[position];
+	}
+	double GetMin(int position) const {
+		return _xmin[position];
+	}
+	double GetMax(int position) const {
+		return _xmax[position];
+	}
+	//Size of the binary form
+	size_t GetBytes() const {
+		std::vector<unsigned char> runs;
+		EncodeRuns(runs);
+		return 6 * sizeof(int) + runs.size() + _values.size() * sizeof(double) + _functions.size() * (sizeof(int) + 2 * sizeof(double));
+	}
+	//Journal must be sorted, as it is made by KANKAN::GetJournal
+	void Write(std::ostream& stream) const {
+		std::vector<unsigned char> runs;
+		EncodeRuns(runs);
+		int header[6] = { _full ? 1 : 0, (int)_knots.size(), (int)_functions.size(), (int)runs.size(), _nModelKnots, _nModelFunctions };
+		stream.write((const char*)header, sizeof(header));
+		stream.write((const char*)runs.data(), runs.size());
+		stream.write((const char*)_values.data(), _values.size() * sizeof(double));
+		stream.write((const char*)_functions.data(), _functions.size() * sizeof(int));
+		stream.write((const char*)_xmin.data(), _xmin.size() * sizeof(double));
+		stream.write((const char*)_xmax.data(), _xmax.size() * sizeof(double));
+	}
+	bool Read(std::istream& stream) {
+		int header[6];
+		if (!stream.read((char*)header, sizeof(header)) || header[1] < 0 || header[2] < 0 || header[3] < 0 ||
+			header[4] < 0 || header[5] < 0) return false;
+		//sizes are checked against the rest of the stream before anything is allocated
+		long long bytes = (long long)header[3] + (long long)header[1] * sizeof(double) + (long long)header[2] * (sizeof(int) + 2 * sizeof(double));
+		auto position = stream.tellg();
+		stream.seekg(0, std::ios::end);
+		long long available = (long long)(stream.tellg() - position);
+		stream.seekg(position);
+		if (!stream || available < bytes) return false;
+		_full = header[0] != 0;
+		_nModelKnots = header[4];
+		_nModelFunctions = header[5];
+		std::vector<unsigned char> runs(header[3]);
+		if (!stream.read((char*)runs.data(), runs.size()) || !DecodeRuns(runs, header[1])) return false;
+		_values.resize(header[1]);
+		_functions.resize(header[2]);
+		_xmin.resize(header[2]);
+		_xmax.resize(header[2]);
+		stream.read((char*)_values.data(), _values.size() * sizeof(double));
+		stream.read((char*)_functions.data(), _functions.size() * sizeof(int));
+		stream.read((char*)_xmin.data(), _xmin.size() * sizeof(double));
+		stream.read((char*)_xmax.data(), _xmax.size() * sizeof(double));
+		return (bool)stream;
+	}
+private:
+	std::vector<int> _knots;
+	std::vector<double> _values;
+	std::vector<int> _functions;
+	std::vector<double> _xmin;
+	std::vector<double> _xmax;
+	bool _full = false;
+	int _nModelKnots = 0;
+	int _nModelFunctions = 0;
+	void EncodeRuns(std::vector<unsigned char>& runs) const {
+		int end = 0;
+		for (int i = 0; i < (int)_knots.size();) {
+			int length = 1;
+			while (i + length < (int)_knots.size() && _knots[i + length] == _knots[i] + length) ++length;
+			PutNumber(runs, _knots[i] - end);
+			PutNumber(runs, length);
+			end = _knots[i] + length;
+			i += length;
+		}
+	}
+	//False when runs do not give nKnots ascending indexes
+	bool DecodeRuns(const std::vector<unsigned char>& runs, int nKnots) {
+		_knots.clear();
+		size_t position = 0;
+		long long end = 0;
+		while (position < runs.size()) {
+			long long gap;
+			long long length;
+			if (!GetNumber(runs, position, gap) || !GetNumber(runs, position, length) || length < 1 ||
+				(long long)_knots.size() + length > nKnots || end + gap + length > std::numeric_limits<int>::max()) return false;
+			for (long long n = end + gap; n < end + gap + length; ++n) {
+				_knots.push_back((int)n);
+			}
+			end += gap + length;
+		}
+		return (int)_knots.size() == nKnots;
+	}
+	//Seven bits in a byte, high bit is set when more bytes follow
+	static void PutNumber(std::vector<unsigned char>& bytes, unsigned int number) {
+		while (number >= 0x80) {
+			bytes.push_back((unsigned char)(number | 0x80));
+			number >>= 7;
+		}
+		bytes.push_back((unsigned char)number);
+	}
+	static bool GetNumber(const std::vector<unsigned char>& bytes, size_t& position, long long& number) {
+		number = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			if (position >= bytes.size()) return false;
+			unsigned char byte = bytes[position++];
+			number |= (long long)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) return true;
+		}
+		return false;
+	}
+	template <typename V>
+	static void Permute(std::vector<V>& values, const std::vector<int>& order) {
+		std::vector<V> permuted(values.size());
+		for (int i = 0; i < (int)order.size(); ++i) {
+			permuted[i] = values[order[i]];
+		}
+		values.swap(permuted);
+	}
+};
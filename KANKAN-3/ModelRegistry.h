@@ -0,0 +1,181 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "PackedModel.h"
+
+//Packed models of a directory served by name, model of name N is the file N.kan. Models are loaded on first
+//use and stay resident while total size is within the budget, least recently used models are evicted first.
+//A model in use by other threads stays alive after eviction until they release it. Cold loads run outside
+//of the lock, two threads may load the same model at once and the second copy is dropped.
+//Store writes a temporary file and renames it over the model, so loads see either the old or the new file.
+//Each Store bumps generation of the name, a load begun under an older generation is repeated, not inserted.
+//Scratch buffer of predictions is one per thread and is shared by all models.
+//Names are file names without directories, empty names and names with /, \, : or .. are rejected.
+template <typename T = double>
+class ModelRegistry {
+public:
+	ModelRegistry(const std::string& directory, size_t budget) {
+		_directory = directory;
+		_budget = budget;
+	}
+	std::string GetFileName(const std::string& name) const {
+		return _directory + "/" + name + ".kan";
+	}
+	static bool IsValidName(const std::string& name) {
+		return !name.empty() && name.find_first_of("/\\:") == std::string::npos && name.find("..") == std::string::npos;
+	}
+	//Writes the model to the directory, resident copy of previous version is dropped, false for invalid name
+	bool Store(const std::string& name, const PackedModel<T>& model) {
+		if (!IsValidName(name)) return false;
+		std::string temporary;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			temporary = GetFileName(name) + "." + std::to_string(++_nTemporary) + ".tmp";
+		}
+		std::error_code error;
+		if (!model.Save(temporary)) {
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+		//on Windows the file can not be replaced while a load has it open, loads are short
+		for (int attempt = 0; attempt < 100; ++attempt) {
+			std::filesystem::rename(temporary, GetFileName(name), error);
+			if (!error) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		if (error) {
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+		std::unique_lock<std::mutex> lock(_mutex);
+		++_generations[name];
+		auto it = _index.find(name);
+		if (it != _index.end()) Remove(it->second);
+		return true;
+	}
+	//Returns nullptr when there is no such model or name is not valid
+	std::shared_ptr<const PackedModel<T>> Get(const std::string& name) {
+		if (!IsValidName(name)) return nullptr;
+		long long generation;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			++_nLookups;
+			auto it = _index.find(name);
+			if (it != _index.end()) {
+				++_nHits;
+				_lru.splice(_lru.begin(), _lru, it->second);
+				return it->second->model;
+			}
+			generation = GetGeneration(name);
+		}
+		while (true) {
+			auto start = Clock::now();
+			auto model = std::make_shared<PackedModel<T>>();
+			bool loaded = model->Load(GetFileName(name));
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			std::unique_lock<std::mutex> lock(_mutex);
+			auto it = _index.find(name);
+			if (it != _index.end()) {
+				_lru.splice(_lru.begin(), _lru, it->second);
+				return it->second->model;
+			}
+			if (GetGeneration(name) != generation) {
+				//stored again while loading, the file may be newer than what was read
+				generation = GetGeneration(name);
+				++_nReloads;
+				continue;
+			}
+			if (!loaded) {
+				++_nFailures;
+				return nullptr;
+			}
+			++_nLoads;
+			_loadTime += seconds;
+			_maxLoadTime = std::max(_maxLoadTime, seconds);
+			Entry entry;
+			entry.name = name;
+			entry.model = model;
+			entry.bytes = model->GetBytes();
+			_lru.push_front(entry);
+			_index[name] = _lru.begin();
+			_resident += entry.bytes;
+			//the new model stays even when it alone exceeds the budget
+			while (_resident > _budget && _lru.size() > 1) {
+				Remove(std::prev(_lru.end()));
+				++_nEvictions;
+			}
+			return model;
+		}
+	}
+	//False when there is no such model
+	bool Predict(const std::string& name, const std::unique_ptr<T[]>& input, std::unique_ptr<T[]>& output) {
+		static thread_local std::vector<T> scratch;
+		auto model = Get(name);
+		if (!model) return false;
+		model->Predict(input, output, scratch);
+		return true;
+	}
+	double GetHitRate() const {
+		std::unique_lock<std::mutex> lock(_mutex);
+		return _nLookups > 0 ? (double)_nHits / _nLookups : 0.0;
+	}
+	size_t GetResidentBytes() const {
+		std::unique_lock<std::mutex> lock(_mutex);
+		return _resident;
+	}
+	int GetNumberOfResident() const {
+		std::unique_lock<std::mutex> lock(_mutex);
+		return (int)_lru.size();
+	}
+	//Counters since start
+	void ShowStatistics() const {
+		std::unique_lock<std::mutex> lock(_mutex);
+		printf("Lookups %lld, hit rate %.1f%%, loads %lld, reloads %lld, failed %lld, evictions %lld, resident %d models %.1f KB of %.1f KB, "
+			"load ms mean %.3f max %.3f\n", _nLookups, _nLookups > 0 ? 100.0 * _nHits / _nLookups : 0.0, _nLoads, _nReloads, _nFailures,
+			_nEvictions, (int)_lru.size(), _resident / 1024.0, _budget / 1024.0, _nLoads > 0 ? 1000.0 * _loadTime / _nLoads : 0.0,
+			1000.0 * _maxLoadTime);
+	}
+private:
+	typedef std::chrono::steady_clock Clock;
+	struct Entry {
+		std::string name;
+		std::shared_ptr<const PackedModel<T>> model;
+		size_t bytes;
+	};
+	std::string _directory;
+	size_t _budget;
+	mutable std::mutex _mutex;
+	//most recently used first
+	std::list<Entry> _lru;
+	std::unordered_map<std::string, typename std::list<Entry>::iterator> _index;
+	//number of Store calls per name
+	std::unordered_map<std::string, long long> _generations;
+	long long _nTemporary = 0;
+	size_t _resident = 0;
+	long long _nLookups = 0;
+	long long _nHits = 0;
+	long long _nLoads = 0;
+	long long _nReloads = 0;
+	long long _nFailures = 0;
+	long long _nEvictions = 0;
+	double _loadTime = 0.0;
+	double _maxLoadTime = 0.0;
+	long long GetGeneration(const std::string& name) const {
+		auto it = _generations.find(name);
+		return (it != _generations.end()) ? it->second : 0;
+	}
+	void Remove(typename std::list<Entry>::iterator it) {
+		_resident -= it->bytes;
+		_index.erase(it->name);
+		_lru.erase(it);
+	}
+};
@@ -0,0 +1,181 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "KANKAN.h"
+#include "LatencyHistogram.h"
+#include "RecordStream.h"
+
+//Online training from a live stream. Ingest thread reads records into bounded queue, training thread
+//applies Train to each record and publishes a copy of the model every publishInterval milliseconds.
+//Predictions are served from the last published snapshot by any number of threads. When queue is full
+//ingest waits, back pressure goes to producer and update latency stays bounded by queue capacity.
+template <typename T = double, typename A = T>
+class OnlineTrainer {
+public:
+	OnlineTrainer(KANKAN<T, A>& kankan, int queueCapacity, int publishInterval) : _kankan(kankan) {
+		if (queueCapacity < 1 || publishInterval < 1) {
+			printf("Fatal: online trainer configuration error\n");
+			exit(0);
+		}
+		_publishInterval = std::chrono::milliseconds(publishInterval);
+		_nFeatures = kankan.GetNumberOfFeatures();
+		_nTargets = kankan.GetNumberOfTargets();
+		_slots = std::vector<Slot>(queueCapacity);
+		for (int i = 0; i < queueCapacity; ++i) {
+			_slots[i].features = std::make_unique<T[]>(_nFeatures);
+			_slots[i].targets = std::make_unique<T[]>(_nTargets);
+		}
+		Publish();
+		_statisticsStart = Clock::now();
+	}
+	~OnlineTrainer() {
+		Wait();
+	}
+	//Returns immediately, training continues until the end of stream
+	void Start(RecordStream& stream) {
+		stream.ReadHeader(sizeof(T), _nFeatures, _nTargets);
+		_running = true;
+		_ingest = std::thread(&OnlineTrainer::Ingest, this, std::ref(stream));
+		_training = std::thread(&OnlineTrainer::Training, this);
+	}
+	void Wait() {
+		if (_ingest.joinable()) _ingest.join();
+		if (_training.joinable()) _training.join();
+	}
+	bool IsRunning() const {
+		std::unique_lock<std::mutex> lock(_mutex);
+		return _running;
+	}
+	//Reentrant, may be called from any thread while training goes on
+	void Predict(const std::unique_ptr<T[]>& input, std::unique_ptr<T[]>& output) const {
+		GetSnapshot()->Predict(input, output);
+	}
+	std::shared_ptr<const KANKAN<T, A>> GetSnapshot() const {
+		return std::atomic_load(&_snapshot);
+	}
+	//Ingest rate, latency from arrival of record to its update and queue depth since previous call
+	void ShowStatistics() {
+		LatencyHistogram latencies;
+		long long nRecords;
+		int maxDepth;
+		long long nSnapshots;
+		{
+			std::unique_lock<std::mutex> lock(_statisticsMutex);
+			std::swap(latencies, _latencies);
+			nRecords = _nIngested;
+			maxDepth = _maxDepth;
+			nSnapshots = _nSnapshots;
+			_nIngested = 0;
+			_maxDepth = 0;
+		}
+		int depth;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			depth = _count;
+		}
+		auto now = Clock::now();
+		double seconds = std::chrono::duration<double>(now - _statisticsStart).count();
+		_statisticsStart = now;
+		printf("Ingest %.0f records/s, update latency us p50 %.1f p95 %.1f p99 %.1f max %.1f, queue depth %d max %d of %d, snapshots %lld\n",
+			nRecords / seconds, latencies.GetPercentile(0.5), latencies.GetPercentile(0.95), latencies.GetPercentile(0.99),
+			latencies.GetMax(), depth, maxDepth, (int)_slots.size(), nSnapshots);
+	}
+private:
+	typedef std::chrono::steady_clock Clock;
+	struct Slot {
+		std::unique_ptr<T[]> features;
+		std::unique_ptr<T[]> targets;
+		Clock::time_point arrival;
+	};
+	KANKAN<T, A>& _kankan;
+	std::shared_ptr<const KANKAN<T, A>> _snapshot;
+	Clock::duration _publishInterval;
+	int _nFeatures;
+	int _nTargets;
+	std::thread _ingest;
+	std::thread _training;
+	//ring of preallocated records, the slot after the last is filled by ingest outside of the lock
+	std::vector<Slot> _slots;
+	int _head = 0;
+	int _count = 0;
+	bool _running = false;
+	mutable std::mutex _mutex;
+	std::condition_variable _notEmpty;
+	std::condition_variable _notFull;
+	std::mutex _statisticsMutex;
+	//microseconds, memory stays fixed when statistics are never shown
+	LatencyHistogram _latencies;
+	long long _nIngested = 0;
+	long long _nSnapshots = 0;
+	int _maxDepth = 0;
+	Clock::time_point _statisticsStart;
+	void Ingest(RecordStream& stream) {
+		int capacity = (int)_slots.size();
+		while (true) {
+			int tail;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_notFull.wait(lock, [this, capacity] { return _count < capacity; });
+				tail = (_head + _count) % capacity;
+			}
+			if (!stream.ReadRecord(_slots[tail].features, _nFeatures, _slots[tail].targets, _nTargets)) break;
+			_slots[tail].arrival = Clock::now();
+			int depth;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				depth = ++_count;
+			}
+			_notEmpty.notify_one();
+			std::unique_lock<std::mutex> lock(_statisticsMutex);
+			++_nIngested;
+			_maxDepth = std::max(_maxDepth, depth);
+		}
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_running = false;
+		}
+		_notEmpty.notify_one();
+	}
+	void Training() {
+		int capacity = (int)_slots.size();
+		auto published = Clock::now();
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_notEmpty.wait(lock, [this] { return _count > 0 || !_running; });
+				if (_count == 0) break;
+			}
+			Slot& slot = _slots[_head];
+			_kankan.Train(slot.features, slot.targets);
+			auto now = Clock::now();
+			double latency = std::chrono::duration<double, std::micro>(now - slot.arrival).count();
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_head = (_head + 1) % capacity;
+				--_count;
+			}
+			_notFull.notify_one();
+			{
+				std::unique_lock<std::mutex> lock(_statisticsMutex);
+				_latencies.Add(latency);
+			}
+			if (now - published >= _publishInterval) {
+				Publish();
+				published = now;
+			}
+		}
+		Publish();
+	}
+	void Publish() {
+		std::shared_ptr<const KANKAN<T, A>> snapshot = std::make_shared<KANKAN<T, A>>(_kankan);
+		std::atomic_store(&_snapshot, snapshot);
+		std::unique_lock<std::mutex> lock(_statisticsMutex);
+		++_nSnapshots;
+	}
+};
@@ -0,0 +1,190 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+//Read only form of a trained model for serving. All functions of all Urysohns are kept in a few flat arrays,
+//so a model takes a handful of allocations regardless of its size. Lines of compacted models are stored as
+//tables of two knots and constants are in biases. Deferred sparse updates are folded into knots.
+//Scratch buffers are given by the caller, one buffer may serve any number of models in turn.
+template <typename T = double>
+class PackedModel {
+public:
+	//Builders used by KANKAN::Pack, layers, Urysohns and functions are added in order of evaluation
+	void Reset(int nFeatures) {
+		_nFeatures = nFeatures;
+		_U.clear();
+		_bias.clear();
+		_functionStart.assign(1, 0);
+		_inputs.clear();
+		_points.clear();
+		_grids.clear();
+		_knotStart.clear();
+		_knots.clear();
+	}
+	void AddLayer(int nUrysohns) {
+		_U.push_back(nUrysohns);
+	}
+	void AddUrysohn(T bias) {
+		_bias.push_back(bias);
+		_functionStart.push_back(_functionStart.back());
+	}
+	void AddFunction(int input, T xmin, T invdeltax, const std::vector<T>& knots) {
+		_inputs.push_back(input);
+		_points.push_back((int)knots.size());
+		_grids.push_back(xmin);
+		_grids.push_back(invdeltax);
+		_knotStart.push_back((int)_knots.size());
+		_knots.insert(_knots.end(), knots.begin(), knots.end());
+		++_functionStart.back();
+	}
+	//Releases spare capacity left by builders
+	void Shrink() {
+		_U.shrink_to_fit();
+		_bias.shrink_to_fit();
+		_functionStart.shrink_to_fit();
+		_inputs.shrink_to_fit();
+		_points.shrink_to_fit();
+		_grids.shrink_to_fit();
+		_knotStart.shrink_to_fit();
+		_knots.shrink_to_fit();
+	}
+	//Scratch is resized on first use to two widest layers
+	void Predict(const std::unique_ptr<T[]>& input, std::unique_ptr<T[]>& output, std::vector<T>& scratch) const {
+		int width = GetMaxWidth();
+		if ((int)scratch.size() < 2 * width) scratch.resize(2 * width);
+		const T* in = input.get();
+		int u = 0;
+		int nLast = (int)_U.size() - 1;
+		for (int k = 0; k <= nLast; ++k) {
+			T* out = (k == nLast) ? output.get() : scratch.data() + (k % 2) * width;
+			for (int i = 0; i < _U[k]; ++i, ++u) {
+				double f = _bias[u];
+				for (int n = _functionStart[u]; n < _functionStart[u + 1]; ++n) {
+					f += GetFunction(n, in[_inputs[n]]);
+				}
+				out[i] = static_cast<T>(f);
+			}
+			in = out;
+		}
+	}
+	int GetNumberOfFeatures() const {
+		return _nFeatures;
+	}
+	int GetNumberOfTargets() const {
+		return _U.empty() ? 0 : _U.back();
+	}
+	int GetMaxWidth() const {
+		return _U.empty() ? 0 : *std::max_element(_U.begin(), _U.end());
+	}
+	//Heap and object size, the registry counts it against its budget
+	size_t GetBytes() const {
+		return sizeof(*this) + (_U.capacity() + _functionStart.capacity() + _inputs.capacity() + _points.capacity() +
+			_knotStart.capacity()) * sizeof(int) + (_bias.capacity() + _grids.capacity() + _knots.capacity()) * sizeof(T);
+	}
+	void Write(std::ostream& stream) const {
+		int header[6] = { _signature, (int)sizeof(T), _nFeatures, (int)_U.size(), (int)_bias.size(), (int)_inputs.size() };
+		int nKnots = (int)_knots.size();
+		stream.write((const char*)header, sizeof(header));
+		stream.write((const char*)&nKnots, sizeof(nKnots));
+		stream.write((const char*)_U.data(), _U.size() * sizeof(int));
+		stream.write((const char*)_bias.data(), _bias.size() * sizeof(T));
+		stream.write((const char*)_functionStart.data(), _functionStart.size() * sizeof(int));
+		stream.write((const char*)_inputs.data(), _inputs.size() * sizeof(int));
+		stream.write((const char*)_points.data(), _points.size() * sizeof(int));
+		stream.write((const char*)_grids.data(), _grids.size() * sizeof(T));
+		stream.write((const char*)_knotStart.data(), _knotStart.size() * sizeof(int));
+		stream.write((const char*)_knots.data(), _knots.size() * sizeof(T));
+	}
+	//False when stream is not a packed model of this scalar type or is truncated
+	bool Read(std::istream& stream) {
+		int header[6];
+		int nKnots;
+		if (!stream.read((char*)header, sizeof(header)) || !stream.read((char*)&nKnots, sizeof(nKnots))) return false;
+		if (header[0] != _signature || header[1] != (int)sizeof(T) || header[2] < 1 || header[3] < 1 ||
+			header[4] < 1 || header[5] < 0 || nKnots < 0) return false;
+		//sizes are checked against the rest of the stream before anything is allocated
+		long long bytes = ((long long)header[3] + header[4] + 1 + 3LL * header[5]) * sizeof(int) +
+			((long long)header[4] + 2LL * header[5] + nKnots) * sizeof(T);
+		auto position = stream.tellg();
+		stream.seekg(0, std::ios::end);
+		long long available = (long long)(stream.tellg() - position);
+		stream.seekg(position);
+		if (!stream || available < bytes) return false;
+		_nFeatures = header[2];
+		_U.resize(header[3]);
+		_bias.resize(header[4]);
+		_functionStart.resize(header[4] + 1);
+		_inputs.resize(header[5]);
+		_points.resize(header[5]);
+		_grids.resize(2 * header[5]);
+		_knotStart.resize(header[5]);
+		_knots.resize(nKnots);
+		stream.read((char*)_U.data(), _U.size() * sizeof(int));
+		stream.read((char*)_bias.data(), _bias.size() * sizeof(T));
+		stream.read((char*)_functionStart.data(), _functionStart.size() * sizeof(int));
+		stream.read((char*)_inputs.data(), _inputs.size() * sizeof(int));
+		stream.read((char*)_points.data(), _points.size() * sizeof(int));
+		stream.read((char*)_grids.data(), _grids.size() * sizeof(T));
+		stream.read((char*)_knotStart.data(), _knotStart.size() * sizeof(int));
+		stream.read((char*)_knots.data(), _knots.size() * sizeof(T));
+		return stream && IsConsistent();
+	}
+	bool Save(const std::string& fileName) const {
+		std::ofstream stream(fileName, std::ios::binary);
+		Write(stream);
+		return (bool)stream;
+	}
+	bool Load(const std::string& fileName) {
+		std::ifstream stream(fileName, std::ios::binary);
+		return stream && Read(stream);
+	}
+private:
+	static const int _signature = 0x4B4E4B50;
+	int _nFeatures = 0;
+	std::vector<int> _U;
+	//per Urysohn, functions of Urysohn u are from _functionStart[u] to _functionStart[u + 1]
+	std::vector<T> _bias;
+	std::vector<int> _functionStart;
+	//per function, input index, number of knots, pairs of lower limit and reciprocal grid step, first knot
+	std::vector<int> _inputs;
+	std::vector<int> _points;
+	std::vector<T> _grids;
+	std::vector<int> _knotStart;
+	std::vector<T> _knots;
+	//indexes read from file stay inside arrays
+	bool IsConsistent() const {
+		long long nUrysohns = 0;
+		for (int k = 0; k < (int)_U.size(); ++k) {
+			if (_U[k] < 1) return false;
+			nUrysohns += _U[k];
+		}
+		if (nUrysohns != (long long)_bias.size() || _functionStart[0] != 0 || _functionStart.back() != (int)_inputs.size()) return false;
+		for (int u = 0; u < (int)_bias.size(); ++u) {
+			if (_functionStart[u + 1] < _functionStart[u]) return false;
+		}
+		int u = 0;
+		for (int k = 0; k < (int)_U.size(); ++k) {
+			int nInputs = (k == 0) ? _nFeatures : _U[k - 1];
+			for (int i = 0; i < _U[k]; ++i, ++u) {
+				for (int n = _functionStart[u]; n < _functionStart[u + 1]; ++n) {
+					if (_inputs[n] < 0 || _inputs[n] >= nInputs || _points[n] < 2 || _knotStart[n] < 0 ||
+						_knotStart[n] > (int)_knots.size() - _points[n]) return false;
+				}
+			}
+		}
+		return true;
+	}
+	//same interpolation as Urysohn, arguments are clamped to limits
+	T GetFunction(int n, T x) const {
+		int points = _points[n];
+		T R = (x - _grids[2 * n]) * _grids[2 * n + 1];
+		R = std::min(std::max(R, T(0)), static_cast<T>(points - 1));
+		int index = std::min((int)R, points - 2);
+		const T* knot = &_knots[_knotStart[n] + index];
+		return knot[0] + (knot[1] - knot[0]) * (R - index);
+	}
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "KANKAN.h"
+
+//Stateful prediction for queries that differ from previous query in few features. Inputs and sums of Urysohns
+//of every layer are kept, only changed inputs are evaluated and their terms replace old terms in the sums, changed
+//outputs go to the next layer the same way. Layer where more than half of inputs changed is computed in full.
+//Session reads the model, it must be Reset after the model is trained. Sums are recomputed every refreshInterval
+//queries, so that rounding errors of increments do not accumulate.
+template <typename T = double, typename A = T>
+class PredictionSession {
+public:
+	PredictionSession(const KANKAN<T, A>& kankan, int refreshInterval = 1000) : _kankan(kankan) {
+		if (refreshInterval < 1) {
+			printf("Fatal: prediction session configuration error\n");
+			exit(0);
+		}
+		_refreshInterval = refreshInterval;
+		Reset();
+	}
+	//Next query is computed in full, input of sparse query starts from zeros
+	void Reset() {
+		_inputs.clear();
+		_outputs.clear();
+		_sums.clear();
+		_nInputs.clear();
+		int nInputs = _kankan.GetNumberOfFeatures();
+		for (int k = 0; k < _kankan.GetNumberOfLayers(); ++k) {
+			int nOutputs = _kankan.GetLayer(k).GetNumberOfUrysohns();
+			_inputs.push_back(std::make_unique<T[]>(nInputs));
+			_outputs.push_back(std::make_unique<T[]>(nOutputs));
+			_sums.push_back(std::make_unique<A[]>(nOutputs));
+			_nInputs.push_back(nInputs);
+			nInputs = nOutputs;
+		}
+		_valid = false;
+		_nQueries = 0;
+	}
+	//Full input, changes are found by comparison with previous query
+	void Predict(const std::unique_ptr<T[]>& input, std::unique_ptr<T[]>& output) {
+		BeginQuery();
+		for (int j = 0; j < _nInputs[0]; ++j) {
+			if (!_valid || input[j] != _inputs[0][j]) {
+				_indexes.push_back(j);
+				_values.push_back(input[j]);
+			}
+		}
+		Propagate(output);
+	}
+	//Only changed features are given, others keep values of previous query
+	void Predict(const SparseInput<T>& changes, std::unique_ptr<T[]>& output) {
+		BeginQuery();
+		for (int n = 0; n < changes.Size(); ++n) {
+			int j = changes.indexes[n];
+			if (changes.values[n] != _inputs[0][j]) {
+				_indexes.push_back(j);
+				_values.push_back(changes.values[n]);
+			}
+		}
+		Propagate(output);
+	}
+	//Inputs evaluated by increments and in full since creation or reset
+	void GetCounters(long long& incremental, long long& full) const {
+		incremental = _nIncremental;
+		full = _nFull;
+	}
+private:
+	const KANKAN<T, A>& _kankan;
+	int _refreshInterval;
+	//inputs and sums of Urysohns of every layer, outputs are sums in model precision
+	std::vector<std::unique_ptr<T[]>> _inputs;
+	std::vector<std::unique_ptr<T[]>> _outputs;
+	std::vector<std::unique_ptr<A[]>> _sums;
+	std::vector<int> _nInputs;
+	//changed inputs of the current layer and their new values
+	std::vector<int> _indexes;
+	std::vector<T> _values;
+	bool _valid = false;
+	int _nQueries = 0;
+	long long _nIncremental = 0;
+	long long _nFull = 0;
+	void BeginQuery() {
+		if (++_nQueries >= _refreshInterval) {
+			_valid = false;
+			_nQueries = 0;
+		}
+		_indexes.clear();
+		_values.clear();
+	}
+	void Propagate(std::unique_ptr<T[]>& output) {
+		int nLayers = (int)_inputs.size();
+		for (int k = 0; k < nLayers; ++k) {
+			const Layer<T, A>& layer = _kankan.GetLayer(k);
+			int nOutputs = layer.GetNumberOfUrysohns();
+			int nChanged = (int)_indexes.size();
+			if (_valid && nChanged == 0) break;
+			if (!_valid || 2 * nChanged > _nInputs[k]) {
+				for (int n = 0; n < nChanged; ++n) {
+					_inputs[k][_indexes[n]] = _values[n];
+				}
+				layer.Input2Output(_inputs[k], _outputs[k]);
+				for (int i = 0; i < nOutputs; ++i) {
+					_sums[k][i] = _outputs[k][i];
+				}
+				_nFull += _nInputs[k];
+			}
+			else {
+				for (int n = 0; n < nChanged; ++n) {
+					int j = _indexes[n];
+					layer.ChangeInput(j, _inputs[k][j], _values[n], _sums[k]);
+					_inputs[k][j] = _values[n];
+				}
+				for (int i = 0; i < nOutputs; ++i) {
+					_outputs[k][i] = static_cast<T>(_sums[k][i]);
+				}
+				_nIncremental += nChanged;
+			}
+			_indexes.clear();
+			_values.clear();
+			if (k + 1 == nLayers) break;
+			for (int i = 0; i < nOutputs; ++i) {
+				if (!_valid || _outputs[k][i] != _inputs[k + 1][i]) {
+					_indexes.push_back(i);
+					_values.push_back(_outputs[k][i]);
+				}
+			}
+		}
+		_valid = true;
+		int nLast = nLayers - 1;
+		for (int i = 0; i < _kankan.GetLayer(nLast).GetNumberOfUrysohns(); ++i) {
+			output[i] = _outputs[nLast][i];
+		}
+	}
+};
@@ -0,0 +1,263 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+#include "RecordStream.h"
+
+//Preallocated block of records, epoch is the pass over data the records belong to
+template <typename T = double>
+struct RecordBlock {
+	std::unique_ptr<std::unique_ptr<T[]>[]> features;
+	std::unique_ptr<std::unique_ptr<T[]>[]> targets;
+	int nRecords = 0;
+	int epoch = 0;
+};
+
+//Source of records for producer threads, Fill is called concurrently and returns false at the end of data
+template <typename T = double>
+class RecordSource {
+public:
+	virtual ~RecordSource() {}
+	virtual bool Fill(RecordBlock<T>& block, int capacity) = 0;
+};
+
+//Records of matrices in memory, each epoch in new random order. Features may be scaled from the given limits
+//to [0, 1]. Blocks do not cross epochs. Order of records depends on seed only, order of blocks on producers.
+template <typename T = double>
+class MatrixSource : public RecordSource<T> {
+public:
+	MatrixSource(const std::unique_ptr<std::unique_ptr<T[]>[]>& features, const std::unique_ptr<std::unique_ptr<T[]>[]>& targets,
+		int nRecords, int nFeatures, int nTargets, int nEpochs, unsigned int seed) : _features(features), _targets(targets) {
+		if (nRecords < 1 || nEpochs < 1) {
+			printf("Fatal: matrix source configuration error\n");
+			exit(0);
+		}
+		_nRecords = nRecords;
+		_nFeatures = nFeatures;
+		_nTargets = nTargets;
+		_nEpochs = nEpochs;
+		_seed = seed;
+	}
+	void SetScaling(const std::vector<T>& xmin, const std::vector<T>& xmax) {
+		_shift = xmin;
+		_scale.clear();
+		for (int j = 0; j < _nFeatures; ++j) {
+			T range = xmax[j] - xmin[j];
+			_scale.push_back(range > 0 ? 1 / range : 1);
+		}
+	}
+	bool Fill(RecordBlock<T>& block, int capacity) {
+		std::shared_ptr<const std::vector<int>> order;
+		int first;
+		int count;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (_position == 0 || _position == _nRecords) {
+				if (_epoch + 1 >= _nEpochs) return false;
+				++_epoch;
+				_position = 0;
+				auto shuffled = std::make_shared<std::vector<int>>(_nRecords);
+				for (int i = 0; i < _nRecords; ++i) {
+					(*shuffled)[i] = i;
+				}
+				std::shuffle(shuffled->begin(), shuffled->end(), std::mt19937(_seed + _epoch));
+				_order = shuffled;
+			}
+			order = _order;
+			first = _position;
+			count = std::min(capacity, _nRecords - _position);
+			_position += count;
+			block.epoch = _epoch;
+		}
+		for (int i = 0; i < count; ++i) {
+			int n = (*order)[first + i];
+			T* features = block.features[i].get();
+			for (int j = 0; j < _nFeatures; ++j) {
+				features[j] = _features[n][j];
+			}
+			if (!_scale.empty()) {
+				for (int j = 0; j < _nFeatures; ++j) {
+					features[j] = (features[j] - _shift[j]) * _scale[j];
+				}
+			}
+			for (int j = 0; j < _nTargets; ++j) {
+				block.targets[i][j] = _targets[n][j];
+			}
+		}
+		block.nRecords = count;
+		return true;
+	}
+private:
+	const std::unique_ptr<std::unique_ptr<T[]>[]>& _features;
+	const std::unique_ptr<std::unique_ptr<T[]>[]>& _targets;
+	int _nRecords;
+	int _nFeatures;
+	int _nTargets;
+	int _nEpochs;
+	unsigned int _seed;
+	std::vector<T> _shift;
+	std::vector<T> _scale;
+	std::mutex _mutex;
+	//current epoch, its order and next record, blocks of previous epoch keep their order alive
+	int _epoch = -1;
+	int _position = 0;
+	std::shared_ptr<const std::vector<int>> _order;
+};
+
+//Records of a stream, one producer reads at a time, all records belong to epoch 0
+template <typename T = double>
+class StreamSource : public RecordSource<T> {
+public:
+	StreamSource(RecordStream& stream, int nFeatures, int nTargets) : _stream(stream) {
+		_nFeatures = nFeatures;
+		_nTargets = nTargets;
+		_stream.ReadHeader(sizeof(T), nFeatures, nTargets);
+	}
+	bool Fill(RecordBlock<T>& block, int capacity) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		block.nRecords = 0;
+		block.epoch = 0;
+		while (block.nRecords < capacity &&
+			_stream.ReadRecord(block.features[block.nRecords], _nFeatures, block.targets[block.nRecords], _nTargets)) {
+			++block.nRecords;
+		}
+		return block.nRecords > 0;
+	}
+private:
+	RecordStream& _stream;
+	int _nFeatures;
+	int _nTargets;
+	std::mutex _mutex;
+};
+
+//Producer threads fill free blocks from the source and push them to the ready queue, the training thread
+//takes ready blocks by Acquire and gives them back by Release. Both queues are lock free. When all blocks are
+//ready producers wait, which is back pressure to the source, when none is ready the trainer waits. Waits are
+//counted as stalls, the trainer never waits while producers keep ahead. With several producers blocks may come
+//out of order, so the last blocks of an epoch can follow the first blocks of the next one.
+template <typename T = double>
+class Prefetcher {
+public:
+	Prefetcher(RecordSource<T>& source, int nProducers, int nBlocks, int blockSize, int nFeatures, int nTargets) :
+		_source(source), _free(nBlocks), _ready(nBlocks) {
+		if (nProducers < 1 || nBlocks < 1 || blockSize < 1) {
+			printf("Fatal: prefetcher configuration error\n");
+			exit(0);
+		}
+		_blockSize = blockSize;
+		_blocks = std::vector<RecordBlock<T>>(nBlocks);
+		for (int b = 0; b < nBlocks; ++b) {
+			_blocks[b].features = std::make_unique<std::unique_ptr<T[]>[]>(blockSize);
+			_blocks[b].targets = std::make_unique<std::unique_ptr<T[]>[]>(blockSize);
+			for (int i = 0; i < blockSize; ++i) {
+				_blocks[b].features[i] = std::make_unique<T[]>(nFeatures);
+				_blocks[b].targets[i] = std::make_unique<T[]>(nTargets);
+			}
+			_free.TryPush(b);
+		}
+		_nActive = nProducers;
+		for (int p = 0; p < nProducers; ++p) {
+			_producers.push_back(std::thread(&Prefetcher::Produce, this));
+		}
+	}
+	~Prefetcher() {
+		_stop = true;
+		for (int p = 0; p < (int)_producers.size(); ++p) {
+			_producers[p].join();
+		}
+	}
+	//Next ready block, nullptr when the source is exhausted and all blocks are consumed
+	RecordBlock<T>* Acquire() {
+		int b;
+		if (_ready.TryPop(b)) return &_blocks[b];
+		auto start = Clock::now();
+		bool found = false;
+		int attempt = 0;
+		while (true) {
+			//producers finish after their last push, so the queue is checked once more after they are done
+			bool done = _nActive.load(std::memory_order_acquire) == 0;
+			if (_ready.TryPop(b)) {
+				found = true;
+				break;
+			}
+			if (done) break;
+			Backoff(attempt);
+		}
+		if (found) {
+			_trainerStalls.fetch_add(1, std::memory_order_relaxed);
+			_trainerStallTime.fetch_add((long long)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count(),
+				std::memory_order_relaxed);
+		}
+		return found ? &_blocks[b] : nullptr;
+	}
+	void Release(RecordBlock<T>* block) {
+		_free.TryPush((int)(block - _blocks.data()));
+	}
+	//Counters since start
+	void ShowStatistics() const {
+		printf("Prefetch blocks %lld, records %lld, trainer stalls %lld for %.3f s, producer stalls %lld\n",
+			_nBlocks.load(), _nRecords.load(), _trainerStalls.load(), _trainerStallTime.load() / 1e6, _producerStalls.load());
+	}
+	long long GetTrainerStalls() const {
+		return _trainerStalls.load();
+	}
+	long long GetProducerStalls() const {
+		return _producerStalls.load();
+	}
+private:
+	typedef std::chrono::steady_clock Clock;
+	RecordSource<T>& _source;
+	int _blockSize;
+	std::vector<RecordBlock<T>> _blocks;
+	//indexes of blocks
+	BoundedQueue<int> _free;
+	BoundedQueue<int> _ready;
+	std::vector<std::thread> _producers;
+	std::atomic<int> _nActive{ 0 };
+	std::atomic<bool> _stop{ false };
+	std::atomic<long long> _nBlocks{ 0 };
+	std::atomic<long long> _nRecords{ 0 };
+	std::atomic<long long> _trainerStalls{ 0 };
+	std::atomic<long long> _trainerStallTime{ 0 };
+	std::atomic<long long> _producerStalls{ 0 };
+	void Produce() {
+		while (!_stop) {
+			int b;
+			if (!_free.TryPop(b)) {
+				_producerStalls.fetch_add(1, std::memory_order_relaxed);
+				int attempt = 0;
+				while (!_stop && !_free.TryPop(b)) {
+					Backoff(attempt);
+				}
+				if (_stop) break;
+			}
+			if (!_source.Fill(_blocks[b], _blockSize)) {
+				_free.TryPush(b);
+				break;
+			}
+			_nBlocks.fetch_add(1, std::memory_order_relaxed);
+			_nRecords.fetch_add(_blocks[b].nRecords, std::memory_order_relaxed);
+			_ready.TryPush(b);
+		}
+		_nActive.fetch_sub(1, std::memory_order_release);
+	}
+	//Waiting thread yields first and then sleeps longer and longer, so that waiting producers do not take
+	//processor time from the trainer
+	static void Backoff(int& attempt) {
+		if (attempt < 16) {
+			std::this_thread::yield();
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000, 10 << std::min(attempt - 16, 7))));
+		}
+		++attempt;
+	}
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "Sockets.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+//Binary framing of streamed records. Stream starts with header, each record follows as nFeatures
+//features and nTargets targets in the scalar type given in header, native byte order.
+struct RecordHeader {
+	int magic;
+	int scalarSize;
+	int nFeatures;
+	int nTargets;
+};
+const int RecordMagic = 0x334E4B4B;
+
+//Source of bytes for online training, Read returns false at the end of stream
+class RecordStream {
+public:
+	virtual ~RecordStream() {}
+	virtual bool Read(void* data, int bytes) = 0;
+	//Reads and validates header against the model
+	void ReadHeader(int scalarSize, int nFeatures, int nTargets) {
+		RecordHeader header;
+		if (!Read(&header, sizeof(header)) || header.magic != RecordMagic || header.scalarSize != scalarSize ||
+			header.nFeatures != nFeatures || header.nTargets != nTargets) {
+			printf("Fatal: record stream header does not match the model\n");
+			exit(0);
+		}
+	}
+	template <typename T>
+	bool ReadRecord(std::unique_ptr<T[]>& features, int nFeatures, std::unique_ptr<T[]>& targets, int nTargets) {
+		return Read(features.get(), nFeatures * sizeof(T)) && Read(targets.get(), nTargets * sizeof(T));
+	}
+	static void WriteHeader(std::ostream& stream, int scalarSize, int nFeatures, int nTargets) {
+		RecordHeader header = { RecordMagic, scalarSize, nFeatures, nTargets };
+		stream.write((const char*)&header, sizeof(header));
+	}
+	template <typename T>
+	static void WriteRecord(std::ostream& stream, const std::unique_ptr<T[]>& features, int nFeatures,
+		const std::unique_ptr<T[]>& targets, int nTargets) {
+		stream.write((const char*)features.get(), nFeatures * sizeof(T));
+		stream.write((const char*)targets.get(), nTargets * sizeof(T));
+	}
+	//Standard streams are opened in text mode on Windows
+	static void SetBinaryMode() {
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	}
+};
+
+//Records from a pipe, standard input or named pipe opened as file
+class PipeRecordStream : public RecordStream {
+public:
+	PipeRecordStream(std::istream& stream) : _stream(stream) {
+	}
+	bool Read(void* data, int bytes) {
+		_stream.read((char*)data, bytes);
+		return _stream.gcount() == bytes;
+	}
+private:
+	std::istream& _stream;
+};
+
+//Records from the single producer connected to the port. There is no authentication, anyone who can connect
+//feeds training records, so by default only local producers can connect. Host is the local address to listen on.
+class SocketRecordStream : public RecordStream {
+public:
+	SocketRecordStream(int port, const std::string& host = "127.0.0.1") {
+#ifdef _WIN32
+		WSADATA data;
+		WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons((unsigned short)port);
+		if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+			printf("Fatal: record stream host %s is not an address\n", host.c_str());
+			exit(0);
+		}
+		SocketHandle listener = socket(AF_INET, SOCK_STREAM, 0);
+		int reuse = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1) != 0) {
+			printf("Fatal: record stream can not listen on port %d\n", port);
+			exit(0);
+		}
+		_socket = accept(listener, NULL, NULL);
+		CloseSocket(listener);
+		if (_socket == InvalidSocket) {
+			printf("Fatal: record stream accept failed\n");
+			exit(0);
+		}
+	}
+	~SocketRecordStream() {
+		CloseSocket(_socket);
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+	bool Read(void* data, int bytes) {
+		char* ptr = (char*)data;
+		while (bytes > 0) {
+			int received = (int)recv(_socket, ptr, bytes, 0);
+			if (received <= 0) return false;
+			ptr += received;
+			bytes -= received;
+		}
+		return true;
+	}
+private:
+	SocketHandle _socket;
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+#include "KANKAN.h"
+
+//Epochs that skip well fitted records. Residual of every record is kept from its last training, records with
+//residual below threshold are trained with probability keepFraction only, others are trained always. Every
+//revisitPeriod epoch is full, it trains all records and refreshes all residuals, so skipped records do not
+//drift away unnoticed. First epoch is full.
+template <typename T = double, typename A = T>
+class ResidualSampler {
+public:
+	ResidualSampler(KANKAN<T, A>& kankan, int nRecords, T threshold, double keepFraction, int revisitPeriod, unsigned int seed) :
+		_kankan(kankan), _random(seed) {
+		if (nRecords < 1 || threshold < 0 || keepFraction < 0.0 || keepFraction > 1.0 || revisitPeriod < 1) {
+			printf("Fatal: residual sampler configuration error\n");
+			exit(0);
+		}
+		_residuals = std::vector<T>(nRecords, 0);
+		_threshold = threshold;
+		_keepFraction = keepFraction;
+		_revisitPeriod = revisitPeriod;
+	}
+	void TrainEpoch(const std::unique_ptr<std::unique_ptr<T[]>[]>& features,
+		const std::unique_ptr<std::unique_ptr<T[]>[]>& targets) {
+		auto start = std::chrono::steady_clock::now();
+		int nRecords = (int)_residuals.size();
+		_full = (_epoch % _revisitPeriod == 0);
+		_nTrained = 0;
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		for (int i = 0; i < nRecords; ++i) {
+			if (!_full && _residuals[i] < _threshold) {
+				if (uniform(_random) >= _keepFraction) continue;
+			}
+			_kankan.Train(features[i], targets[i]);
+			_residuals[i] = _kankan.GetResidual();
+			++_nTrained;
+		}
+		_epochTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		_totalTime += _epochTime;
+		_nTotalTrained += _nTrained;
+		++_epoch;
+	}
+	//Counters of the last epoch, residuals are the last known ones and skipped records keep old values
+	void ShowStatistics() const {
+		int nRecords = (int)_residuals.size();
+		int nBelow = 0;
+		for (int i = 0; i < nRecords; ++i) {
+			if (_residuals[i] < _threshold) ++nBelow;
+		}
+		printf("%s epoch, trained %d of %d records, %d below threshold, time %.3f, total trained %lld in %.3f\n",
+			_full ? "Full" : "Sampled", _nTrained, nRecords, nBelow, _epochTime, _nTotalTrained, _totalTime);
+	}
+	void SetThreshold(T threshold) {
+		_threshold = threshold;
+	}
+	bool IsFullEpoch() const {
+		return _full;
+	}
+	int GetNumberOfTrained() const {
+		return _nTrained;
+	}
+private:
+	KANKAN<T, A>& _kankan;
+	std::mt19937 _random;
+	std::vector<T> _residuals;
+	T _threshold;
+	double _keepFraction;
+	int _revisitPeriod;
+	int _epoch = 0;
+	bool _full = false;
+	int _nTrained = 0;
+	long long _nTotalTrained = 0;
+	double _epochTime = 0.0;
+	double _totalTime = 0.0;
+};
@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transport.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Transport between processes on one host. The segment holds a barrier and one slot per rank,
+//every rank copies its values into own slot and reduces all slots after the barrier.
+//Vectors longer than capacity are reduced in chunks. Rank 0 creates the segment, other ranks wait for it.
+class SharedMemoryTransport : public Transport {
+public:
+	SharedMemoryTransport(const std::string& name, int rank, int size, int capacity) {
+		if (rank < 0 || rank >= size || capacity < 1) {
+			printf("Fatal: shared memory transport configuration error\n");
+			exit(0);
+		}
+		static_assert(ATOMIC_INT_LOCK_FREE == 2, "Shared memory barrier needs lock free atomics");
+		_rank = rank;
+		_size = size;
+		_capacity = capacity;
+		_bytes = sizeof(Header) + sizeof(double) * (size_t)capacity * size;
+		_name = name;
+		Attach();
+		_header = reinterpret_cast<Header*>(_memory);
+		_slots = reinterpret_cast<double*>(_memory + sizeof(Header));
+		//all ranks are attached after this point, the name is not needed anymore
+		Barrier();
+#ifndef _WIN32
+		if (_rank == 0) shm_unlink(_name.c_str());
+#endif
+	}
+	~SharedMemoryTransport() {
+#ifdef _WIN32
+		UnmapViewOfFile(_memory);
+		CloseHandle(_handle);
+#else
+		munmap(_memory, _bytes);
+#endif
+	}
+	int GetRank() const {
+		return _rank;
+	}
+	int GetSize() const {
+		return _size;
+	}
+	void AllReduce(std::vector<double>& values, ReduceOperation operation) {
+		int n = (int)values.size();
+		for (int start = 0; start < n; start += _capacity) {
+			int count = std::min(_capacity, n - start);
+			memcpy(_slots + (size_t)_rank * _capacity, values.data() + start, sizeof(double) * count);
+			Barrier();
+			memcpy(values.data() + start, _slots, sizeof(double) * count);
+			for (int r = 1; r < _size; ++r) {
+				Reduce(values.data() + start, _slots + (size_t)r * _capacity, count, operation);
+			}
+			//slots are not overwritten until all ranks have read them
+			Barrier();
+		}
+	}
+private:
+	struct Header {
+		std::atomic<int> count;
+		std::atomic<int> sense;
+		char padding[64 - 2 * sizeof(std::atomic<int>)];
+	};
+	int _rank;
+	int _size;
+	int _capacity;
+	int _sense = 0;
+	size_t _bytes;
+	std::string _name;
+	char* _memory = nullptr;
+	Header* _header;
+	double* _slots;
+#ifdef _WIN32
+	HANDLE _handle;
+#endif
+	//Sense reversing barrier, the last arriving rank releases the others
+	void Barrier() {
+		_sense = 1 - _sense;
+		if (_header->count.fetch_add(1) + 1 == _size) {
+			_header->count.store(0);
+			_header->sense.store(_sense);
+		}
+		else {
+			while (_header->sense.load() != _sense) {
+				std::this_thread::yield();
+			}
+		}
+	}
+	void Attach() {
+#ifdef _WIN32
+		if (_rank == 0) {
+			_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+				(DWORD)((unsigned long long)_bytes >> 32), (DWORD)(_bytes & 0xFFFFFFFF), _name.c_str());
+		}
+		else {
+			while ((_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, _name.c_str())) == NULL) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+		if (_handle == NULL) {
+			printf("Fatal: shared memory segment %s is not created\n", _name.c_str());
+			exit(0);
+		}
+		_memory = (char*)MapViewOfFile(_handle, FILE_MAP_ALL_ACCESS, 0, 0, _bytes);
+		if (_memory == NULL) {
+			printf("Fatal: shared memory segment %s is not mapped\n", _name.c_str());
+			exit(0);
+		}
+#else
+		int fd = -1;
+		if (_rank == 0) {
+			shm_unlink(_name.c_str());
+			fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (fd < 0 || ftruncate(fd, (off_t)_bytes) != 0) {
+				printf("Fatal: shared memory segment %s is not created\n", _name.c_str());
+				exit(0);
+			}
+		}
+		else {
+			//segment is ready when rank 0 has set its size
+			while (true) {
+				fd = shm_open(_name.c_str(), O_RDWR, 0600);
+				if (fd >= 0) {
+					struct stat info;
+					if (fstat(fd, &info) == 0 && (size_t)info.st_size >= _bytes) break;
+					close(fd);
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+		void* memory = mmap(NULL, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (memory == MAP_FAILED) {
+			printf("Fatal: shared memory segment %s is not mapped\n", _name.c_str());
+			exit(0);
+		}
+		_memory = (char*)memory;
+#endif
+	}
+};
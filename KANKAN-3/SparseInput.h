@@ -0,0 +1,20 @@
+#pragma once
+#include <vector>
+
+//Input vector given by its nonzero elements, indexes must be unique, all other inputs are zero
+template <typename T = double>
+struct SparseInput {
+	std::vector<int> indexes;
+	std::vector<T> values;
+	void Add(int index, T value) {
+		indexes.push_back(index);
+		values.push_back(value);
+	}
+	void Clear() {
+		indexes.clear();
+		values.clear();
+	}
+	int Size() const {
+		return (int)indexes.size();
+	}
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+//Adaptive step factors of layers, every layer adapts on its own signal. After each block the trainer gives every
+//layer the cosine between its combined step and its combined step of the previous block. Means of cosines are
+//taken over periods of blocks, layer by layer. A clearly positive mean means that successive steps go the same
+//way and the layer moves too slowly, its factor grows, a clearly negative mean means that steps oscillate and
+//the factor shrinks. Every layer has own starting factor and limits relative to it.
+class StepSchedule {
+public:
+	StepSchedule(const std::vector<double>& initial, double increase, double decrease, double min, double max, int period) {
+		if (initial.empty() || increase < 1.0 || decrease <= 0.0 || decrease > 1.0 || min <= 0.0 || min > max || period < 1) {
+			printf("Fatal: step schedule configuration error\n");
+			exit(0);
+		}
+		for (int k = 0; k < (int)initial.size(); ++k) {
+			if (initial[k] <= 0.0) {
+				printf("Fatal: step schedule configuration error\n");
+				exit(0);
+			}
+		}
+		_initial = initial;
+		_factors = initial;
+		_increase = increase;
+		_decrease = decrease;
+		_min = min;
+		_max = max;
+		_period = period;
+		_sums.assign(initial.size(), 0.0);
+		_counts.assign(initial.size(), 0);
+	}
+	//Schedule used by TrainBlock unless another is set, period is in blocks. Picked on demos with blocks of 8:
+	//starting factor 0.5, factors grow or shrink by 5% per 250 blocks, within 0.25 and 4 of the start.
+	static StepSchedule Default(int nLayers) {
+		return StepSchedule(std::vector<double>(nLayers, 0.5), 1.05, 1.0 / 1.05, 0.25, 4.0, 250);
+	}
+	double GetFactor(int k) const {
+		return _factors[k];
+	}
+	int GetNumberOfLayers() const {
+		return (int)_factors.size();
+	}
+	void AddAgreement(int k, double cosine) {
+		_sums[k] += cosine;
+		if (++_counts[k] < _period) return;
+		double mean = _sums[k] / _counts[k];
+		double ratio = 1.0;
+		if (mean > _growth) ratio = _increase;
+		if (mean < _oscillation) ratio = _decrease;
+		_factors[k] = std::min(std::max(_factors[k] * ratio, _min * _initial[k]), _max * _initial[k]);
+		_sums[k] = 0.0;
+		_counts[k] = 0;
+	}
+private:
+	std::vector<double> _initial;
+	std::vector<double> _factors;
+	double _increase;
+	double _decrease;
+	double _min;
+	double _max;
+	int _period;
+	//means are noisy and means of inner layers stay slightly negative at any factor, so that shrinking needs
+	//clear oscillation, otherwise factors slide to the lower limit on long epochs
+	const double _growth = 0.05;
+	const double _oscillation = -0.15;
+	std::vector<double> _sums;
+	std::vector<int> _counts;
+};
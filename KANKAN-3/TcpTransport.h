@@ -0,0 +1,140 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Sockets.h"
+#include "Transport.h"
+
+//Star topology over TCP, stands in for a network transport and works over loopback.
+//Rank 0 listens on the port, receives values of other ranks in order of ranks, reduces them and sends result back.
+class TcpTransport : public Transport {
+public:
+	TcpTransport(int rank, int size, int port, const std::string& host = "127.0.0.1") {
+		if (rank < 0 || rank >= size) {
+			printf("Fatal: tcp transport configuration error\n");
+			exit(0);
+		}
+		_rank = rank;
+		_size = size;
+#ifdef _WIN32
+		WSADATA data;
+		WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons((unsigned short)port);
+		inet_pton(AF_INET, host.c_str(), &address.sin_addr);
+		if (rank == 0) {
+			_sockets = std::vector<SocketHandle>(size);
+			SocketHandle listener = socket(AF_INET, SOCK_STREAM, 0);
+			int reuse = 1;
+			setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+			if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, size) != 0) {
+				printf("Fatal: tcp transport can not listen on port %d\n", port);
+				exit(0);
+			}
+			//each rank introduces itself once, ranks come from the network and are checked
+			std::vector<bool> seen(size, false);
+			for (int i = 1; i < size; ++i) {
+				SocketHandle connection = accept(listener, NULL, NULL);
+				if (connection == InvalidSocket) {
+					printf("Fatal: tcp transport accept failed\n");
+					exit(0);
+				}
+				int peer = 0;
+				Receive(connection, &peer, sizeof(peer));
+				if (peer < 1 || peer >= size || seen[peer]) {
+					printf("Fatal: tcp transport got invalid or repeated rank %d\n", peer);
+					exit(0);
+				}
+				seen[peer] = true;
+				SetNoDelay(connection);
+				_sockets[peer] = connection;
+			}
+			CloseSocket(listener);
+		}
+		else {
+			while (true) {
+				_server = socket(AF_INET, SOCK_STREAM, 0);
+				if (connect(_server, (sockaddr*)&address, sizeof(address)) == 0) break;
+				CloseSocket(_server);
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			SetNoDelay(_server);
+			Send(_server, &_rank, sizeof(_rank));
+		}
+	}
+	~TcpTransport() {
+		if (_rank == 0) {
+			for (int i = 1; i < _size; ++i) {
+				CloseSocket(_sockets[i]);
+			}
+		}
+		else {
+			CloseSocket(_server);
+		}
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+	int GetRank() const {
+		return _rank;
+	}
+	int GetSize() const {
+		return _size;
+	}
+	void AllReduce(std::vector<double>& values, ReduceOperation operation) {
+		int bytes = (int)(values.size() * sizeof(double));
+		if (_rank == 0) {
+			_buffer.resize(values.size());
+			for (int i = 1; i < _size; ++i) {
+				Receive(_sockets[i], _buffer.data(), bytes);
+				Reduce(values.data(), _buffer.data(), (int)values.size(), operation);
+			}
+			for (int i = 1; i < _size; ++i) {
+				Send(_sockets[i], values.data(), bytes);
+			}
+		}
+		else {
+			Send(_server, values.data(), bytes);
+			Receive(_server, values.data(), bytes);
+		}
+	}
+private:
+	int _rank;
+	int _size;
+	std::vector<SocketHandle> _sockets;
+	SocketHandle _server;
+	std::vector<double> _buffer;
+	static void SetNoDelay(SocketHandle handle) {
+		int flag = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+	}
+	static void Send(SocketHandle handle, const void* data, int bytes) {
+		const char* ptr = (const char*)data;
+		while (bytes > 0) {
+			int sent = (int)send(handle, ptr, bytes, 0);
+			if (sent <= 0) {
+				printf("Fatal: tcp transport send failed\n");
+				exit(0);
+			}
+			ptr += sent;
+			bytes -= sent;
+		}
+	}
+	static void Receive(SocketHandle handle, void* data, int bytes) {
+		char* ptr = (char*)data;
+		while (bytes > 0) {
+			int received = (int)recv(handle, ptr, bytes, 0);
+			if (received <= 0) {
+				printf("Fatal: tcp transport receive failed\n");
+				exit(0);
+			}
+			ptr += received;
+			bytes -= received;
+		}
+	}
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed set of threads executing indexed tasks. Run blocks until all tasks are completed,
+//the calling thread takes tasks as well, so the pool of size N starts N - 1 workers.
+class ThreadPool {
+public:
+	ThreadPool(int nThreads) {
+		if (nThreads < 1) {
+			printf("Fatal: thread pool needs at least one thread\n");
+			exit(0);
+		}
+		_nThreads = nThreads;
+		for (int i = 0; i < nThreads - 1; ++i) {
+			_workers.push_back(std::thread(&ThreadPool::Loop, this));
+		}
+	}
+	~ThreadPool() {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_start.notify_all();
+		for (int i = 0; i < (int)_workers.size(); ++i) {
+			_workers[i].join();
+		}
+	}
+	void Run(int nTasks, const std::function<void(int)>& task) {
+		if (nTasks <= 0) return;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_finish.wait(lock, [this] { return _active == 0; });
+			_task = &task;
+			_nTasks = nTasks;
+			_next = 0;
+			++_generation;
+		}
+		_start.notify_all();
+		Work();
+		std::unique_lock<std::mutex> lock(_mutex);
+		_finish.wait(lock, [this] { return _active == 0; });
+	}
+	int GetNumberOfThreads() const {
+		return _nThreads;
+	}
+private:
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _start;
+	std::condition_variable _finish;
+	const std::function<void(int)>* _task = nullptr;
+	std::atomic<int> _next{ 0 };
+	int _nTasks = 0;
+	int _active = 0;
+	long long _generation = 0;
+	bool _stop = false;
+	int _nThreads;
+	//workers are counted as active under the mutex, so Run never resets tasks under a running worker
+	void Work() {
+		while (true) {
+			int n = _next.fetch_add(1);
+			if (n >= _nTasks) break;
+			(*_task)(n);
+		}
+	}
+	void Loop() {
+		long long seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_start.wait(lock, [this, seen] { return _stop || _generation != seen; });
+				if (_stop) return;
+				seen = _generation;
+				++_active;
+			}
+			Work();
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				--_active;
+			}
+			_finish.notify_all();
+		}
+	}
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+
+enum class ReduceOperation { Sum, Min, Max };
+
+//Communication between replicas of data parallel training. All ranks call AllReduce in the same order,
+//on return every rank holds the same result, reduction is done in the order of ranks.
+class Transport {
+public:
+	virtual ~Transport() {}
+	virtual int GetRank() const = 0;
+	virtual int GetSize() const = 0;
+	virtual void AllReduce(std::vector<double>& values, ReduceOperation operation) = 0;
+protected:
+	static void Reduce(double* result, const double* values, int n, ReduceOperation operation) {
+		switch (operation) {
+		case ReduceOperation::Sum:
+			for (int i = 0; i < n; ++i) result[i] += values[i];
+			break;
+		case ReduceOperation::Min:
+			for (int i = 0; i < n; ++i) if (values[i] < result[i]) result[i] = values[i];
+			break;
+		case ReduceOperation::Max:
+			for (int i = 0; i < n; ++i) if (values[i] > result[i]) result[i] = values[i];
+			break;
+		}
+	}
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+//Sparse accumulator of knot increments and limit extensions. Knots and functions are addressed
+//by flat indexes over the whole network, only touched entries are listed, merged and cleared.
+template <typename A = double>
+class UpdateBuffer {
+public:
+	void Resize(int nKnots, int nFunctions) {
+		if (nKnots != _nKnots) {
+			_nKnots = nKnots;
+			_knots = std::make_unique<A[]>(nKnots);
+			_knotFlags = std::make_unique<bool[]>(nKnots);
+			_knotList.clear();
+		}
+		if (nFunctions != _nFunctions) {
+			_nFunctions = nFunctions;
+			_xmin = std::make_unique<A[]>(nFunctions);
+			_xmax = std::make_unique<A[]>(nFunctions);
+			_functionFlags = std::make_unique<bool[]>(nFunctions);
+			_functionList.clear();
+			for (int i = 0; i < nFunctions; ++i) {
+				_xmin[i] = std::numeric_limits<A>::max();
+				_xmax[i] = -std::numeric_limits<A>::max();
+			}
+		}
+	}
+	void AddKnot(int n, A value) {
+		if (!_knotFlags[n]) {
+			_knotFlags[n] = true;
+			_knotList.push_back(n);
+		}
+		_knots[n] += value;
+	}
+	void ExtendLimits(int n, A xmin, A xmax) {
+		if (!_functionFlags[n]) {
+			_functionFlags[n] = true;
+			_functionList.push_back(n);
+		}
+		if (xmin < _xmin[n]) _xmin[n] = xmin;
+		if (xmax > _xmax[n]) _xmax[n] = xmax;
+	}
+	void Merge(const UpdateBuffer& buffer) {
+		for (int i = 0; i < (int)buffer._knotList.size(); ++i) {
+			int n = buffer._knotList[i];
+			AddKnot(n, buffer._knots[n]);
+		}
+		for (int i = 0; i < (int)buffer._functionList.size(); ++i) {
+			int n = buffer._functionList[i];
+			ExtendLimits(n, buffer._xmin[n], buffer._xmax[n]);
+		}
+	}
+	//Increments are multiplied by factor, limit extensions stay
+	void Scale(A factor) {
+		for (int i = 0; i < (int)_knotList.size(); ++i) {
+			_knots[_knotList[i]] *= factor;
+		}
+	}
+	//Same for listed knots with indexes from first to end, not including end
+	void Scale(A factor, int first, int end) {
+		for (int i = 0; i < (int)_knotList.size(); ++i) {
+			int n = _knotList[i];
+			if (n >= first && n < end) _knots[n] *= factor;
+		}
+	}
+	//Lists are sorted before applying, so they can be consumed Urysohn by Urysohn in one pass
+	void Sort() {
+		std::sort(_knotList.begin(), _knotList.end());
+		std::sort(_functionList.begin(), _functionList.end());
+	}
+	void Clear() {
+		for (int i = 0; i < (int)_knotList.size(); ++i) {
+			_knots[_knotList[i]] = 0;
+			_knotFlags[_knotList[i]] = false;
+		}
+		for (int i = 0; i < (int)_functionList.size(); ++i) {
+			_xmin[_functionList[i]] = std::numeric_limits<A>::max();
+			_xmax[_functionList[i]] = -std::numeric_limits<A>::max();
+			_functionFlags[_functionList[i]] = false;
+		}
+		_knotList.clear();
+		_functionList.clear();
+	}
+	const std::vector<int>& GetKnotList() const {
+		return _knotList;
+	}
+	const std::vector<int>& GetFunctionList() const {
+		return _functionList;
+	}
+	A GetKnot(int n) const {
+		return _knots[n];
+	}
+	A GetMin(int n) const {
+		return _xmin[n];
+	}
+	A GetMax(int n) const {
+		return _xmax[n];
+	}
+private:
+	int _nKnots = 0;
+	int _nFunctions = 0;
+	std::unique_ptr<A[]> _knots;
+	std::unique_ptr<bool[]> _knotFlags;
+	std::vector<int> _knotList;
+	std::unique_ptr<A[]> _xmin;
+	std::unique_ptr<A[]> _xmax;
+	std::unique_ptr<bool[]> _functionFlags;
+	std::vector<int> _functionList;
+};
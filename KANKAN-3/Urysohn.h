@@ -1,80 +1,615 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <vector>
+#include "UpdateBuffer.h"
+#include "SparseInput.h"
+#include "ModelJournal.h"
+#include "PackedModel.h"
+#include "BinnedInputs.h"
 
+//Training counters of one function, compacted functions have no points
+struct FunctionTelemetry {
+	int points;
+	int occupiedSegments;
+	int coldSegments;
+	int hotSegments;
+	long long hits;
+	double magnitude;
+};
+
+//T is the scalar type of model and data, A is the type of accumulated sums
+template <typename T = double, typename A = T>
 class Urysohn {
 public:
-	Urysohn(const std::vector<double>& argmin, const std::vector<double>& argmax, double umin, double umax, int nPoints) {
+	Urysohn(const std::vector<T>& argmin, const std::vector<T>& argmax, T umin, T umax, int nPoints) {
 		if (argmin.size() != argmax.size()) {
 			printf("Fatal: argument sizes mismatch");
 			exit(0);
 		}
 		int nFunctions = (int)argmin.size();
-		double fmin = umin / nFunctions;
-		double fmax = umax / nFunctions;
-		_model = std::vector<std::vector<double>>(nFunctions);
+		T fmin = umin / nFunctions;
+		T fmax = umax / nFunctions;
+		_model = std::vector<std::vector<T>>(nFunctions);
 		for (int i = 0; i < nFunctions; ++i) {
-			_model[i] = std::vector<double>(nPoints);
+			_model[i] = std::vector<T>(nPoints);
 			for (int j = 0; j < nPoints; ++j) {
-				_model[i][j] = (rand() % 1000 / 1000.0) * (fmax - fmin) + fmin;
+				_model[i][j] = static_cast<T>((rand() % 1000 / 1000.0) * (fmax - fmin) + fmin);
 			}
 		}
-		_xmin = std::vector<double>(nFunctions);
-		_xmax = std::vector<double>(nFunctions);
-		_deltax = std::vector<double>(nFunctions);
+		_xmin = std::vector<T>(nFunctions);
+		_xmax = std::vector<T>(nFunctions);
+		_deltax = std::vector<T>(nFunctions);
+		_invdeltax = std::vector<T>(nFunctions);
+		_segments = std::vector<std::vector<T>>(nFunctions);
 		for (int i = 0; i < nFunctions; ++i) {
 			_xmin[i] = argmin[i];
 			_xmax[i] = argmax[i];
 			SetLimits(i);
+			Tabulate(i);
 		}
+		_slope = std::vector<T>(nFunctions);
+		_intercept = std::vector<T>(nFunctions);
+		for (int i = 0; i < nFunctions; ++i) {
+			_tables.push_back(i);
+		}
+		RefreshBaseline();
 	}
 	Urysohn(const Urysohn& uri) {
 		_xmin.clear();
-		_xmin = std::vector<double>(uri._xmin.size());
+		_xmin = std::vector<T>(uri._xmin.size());
 		for (int i = 0; i < (int)uri._xmin.size(); ++i) {
 			_xmin[i] = uri._xmin[i];
 		}
 		_xmax.clear();
-		_xmax = std::vector<double>(uri._xmax.size());
+		_xmax = std::vector<T>(uri._xmax.size());
 		for (int i = 0; i < (int)uri._xmax.size(); ++i) {
 			_xmax[i] = uri._xmax[i];
 		}
 		_deltax.clear();
-		_deltax = std::vector<double>(uri._deltax.size());
+		_deltax = std::vector<T>(uri._deltax.size());
 		for (int i = 0; i < (int)uri._deltax.size(); ++i) {
 			_deltax[i] = uri._deltax[i];
 		}
 		_model.clear();
-		_model = std::vector<std::vector<double>>(uri._model.size());
+		_model = std::vector<std::vector<T>>(uri._model.size());
 		for (int i = 0; i < (int)uri._model.size(); ++i) {
-			_model[i] = std::vector<double>(uri._model[i].size());
+			_model[i] = std::vector<T>(uri._model[i].size());
 			for (int j = 0; j < (int)uri._model[i].size(); ++j) {
 				_model[i][j] = uri._model[i][j];
 			}
 		}
+		_invdeltax = uri._invdeltax;
+		_segments = uri._segments;
+		_hits = uri._hits;
+		_magnitudes = uri._magnitudes;
+		_zeros = uri._zeros;
+		_zeroSegments = uri._zeroSegments;
+		_zeroOffsets = uri._zeroOffsets;
+		_zeroWeights = uri._zeroWeights;
+		_zeroStamps = uri._zeroStamps;
+		_zeroSum = uri._zeroSum;
+		_zeroWeight = uri._zeroWeight;
+		_stampSum = uri._stampSum;
+		_zeroTotal = uri._zeroTotal;
+		_nDeferred = uri._nDeferred;
+		_tables = uri._tables;
+		_lines = uri._lines;
+		_constants = uri._constants;
+		_slope = uri._slope;
+		_intercept = uri._intercept;
+		_bias = uri._bias;
+		_gridVersion = uri._gridVersion;
 	}
-	double GetUrysohn(const std::unique_ptr<double[]>& inputs, std::unique_ptr<double[]>& derivatives) {
-		double f = 0.0;
-		for (int i = 0; i < _model.size(); ++i) {
+	T GetUrysohn(const std::unique_ptr<T[]>& inputs, std::unique_ptr<T[]>& derivatives) const {
+		A f = _bias;
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			int i = _tables[n];
 			f += GetFunction(i, inputs[i], derivatives[i]);
 		}
-		return f;
+		for (int n = 0; n < (int)_lines.size(); ++n) {
+			int i = _lines[n];
+			derivatives[i] = _slope[i];
+			f += GetLine(i, inputs[i]);
+		}
+		for (int n = 0; n < (int)_constants.size(); ++n) {
+			derivatives[_constants[n]] = 0;
+		}
+		if (_nDeferred > 0) {
+			for (int n = 0; n < (int)_tables.size(); ++n) {
+				int i = _tables[n];
+				T derivative;
+				f += GetDeferred(i, inputs[i], derivative);
+				derivatives[i] += derivative;
+			}
+		}
+		return static_cast<T>(f);
 	}
-	double GetUrysohn(const std::unique_ptr<double[]>& inputs) {
-		double f = 0.0;
-		for (int i = 0; i < (int)_model.size(); ++i) {
+	//Tables of matched functions take cells and offsets of binned inputs, other functions take inputs
+	T GetUrysohn(const std::unique_ptr<T[]>& inputs, const uint16_t* cells, const float* offsets, const char* matched,
+		std::unique_ptr<T[]>& derivatives) const {
+		A f = _bias;
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			int i = _tables[n];
+			if (matched[i] && cells[i] != BinnedInputs<T>::outside) {
+				f += GetCell(i, cells[i], static_cast<T>(offsets[i]), derivatives[i]);
+			}
+			else {
+				f += GetFunction(i, inputs[i], derivatives[i]);
+			}
+		}
+		for (int n = 0; n < (int)_lines.size(); ++n) {
+			int i = _lines[n];
+			derivatives[i] = _slope[i];
+			f += GetLine(i, inputs[i]);
+		}
+		for (int n = 0; n < (int)_constants.size(); ++n) {
+			derivatives[_constants[n]] = 0;
+		}
+		if (_nDeferred > 0) {
+			for (int n = 0; n < (int)_tables.size(); ++n) {
+				int i = _tables[n];
+				T derivative;
+				f += GetDeferred(i, inputs[i], derivative);
+				derivatives[i] += derivative;
+			}
+		}
+		return static_cast<T>(f);
+	}
+	T GetUrysohn(const std::unique_ptr<T[]>& inputs) const {
+		A f = _bias;
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			int i = _tables[n];
 			f += GetFunction(i, inputs[i]);
 		}
+		for (int n = 0; n < (int)_lines.size(); ++n) {
+			int i = _lines[n];
+			f += GetLine(i, inputs[i]);
+		}
+		if (_nDeferred > 0) {
+			T derivative;
+			for (int n = 0; n < (int)_tables.size(); ++n) {
+				int i = _tables[n];
+				f += GetDeferred(i, inputs[i], derivative);
+			}
+		}
+		return static_cast<T>(f);
+	}
+	//Sparse inputs, the sum of functions at zero is cached, only nonzero inputs add corrections
+	T GetUrysohn(const SparseInput<T>& inputs) const {
+		A f = _bias + _zeroSum + _zeroTotal * _zeroWeight - _stampSum;
+		for (int n = 0; n < inputs.Size(); ++n) {
+			int i = inputs.indexes[n];
+			T x = inputs.values[n];
+			if (_model[i].empty()) {
+				f += GetLine(i, x) - _zeros[i];
+				continue;
+			}
+			f += GetFunction(i, x) - _zeros[i];
+			if (_nDeferred > 0) {
+				T derivative;
+				f += GetDeferred(i, x, derivative) - (_zeroTotal - _zeroStamps[i]) * _zeroWeights[i];
+			}
+		}
+		return static_cast<T>(f);
+	}
+	//Term of input k in the sum, constant functions are already in bias
+	T GetTerm(int k, T x) const {
+		if (_model[k].empty()) return GetLine(k, x);
+		T f = GetFunction(k, x);
+		if (_nDeferred > 0) {
+			T derivative;
+			f += GetDeferred(k, x, derivative);
+		}
 		return f;
 	}
-	void Update(double delta, const std::unique_ptr<double[]>& inputs) {
-		for (int i = 0; i < _model.size(); ++i) {
+	//Compacted functions are frozen, only tables are updated
+	void Update(T delta, const std::unique_ptr<T[]>& inputs) {
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			int i = _tables[n];
 			Update(i, inputs[i], delta);
 		}
 	}
+	//Inputs outside of limits are not binned, they extend limits as in dense Update
+	void Update(T delta, const std::unique_ptr<T[]>& inputs, const uint16_t* cells, const float* offsets, const char* matched) {
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			int i = _tables[n];
+			if (matched[i] && cells[i] != BinnedInputs<T>::outside) {
+				UpdateSegment(i, cells[i], static_cast<T>(offsets[i]), delta, false);
+			}
+			else {
+				Update(i, inputs[i], delta);
+			}
+		}
+	}
+	//Same result as dense Update. Functions of nonzero inputs are updated now, updates of functions
+	//of zero inputs are deferred and counted in the cached sum at zero. Zero is expected inside limits.
+	void Update(T delta, const SparseInput<T>& inputs) {
+		A total = _zeroTotal + delta;
+		for (int n = 0; n < inputs.Size(); ++n) {
+			int i = inputs.indexes[n];
+			if (_model[i].empty()) continue;
+			Materialize(i);
+			Update(i, inputs.values[n], delta);
+			_stampSum += (total - _zeroStamps[i]) * _zeroWeights[i];
+			_zeroStamps[i] = total;
+		}
+		_zeroTotal = total;
+		//deferred updates are applied after as many records as functions, cost per record stays constant
+		if (++_nDeferred >= (int)_tables.size()) Flush();
+	}
+	//Applies deferred updates of sparse training to knots
+	void Flush() {
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			Materialize(_tables[n]);
+		}
+		_zeroTotal = 0;
+		_zeroStamps.assign(_model.size(), 0);
+		_nDeferred = 0;
+		RefreshBaseline();
+	}
+	//Same increments as Update, but collected in the buffer and the model is not changed,
+	//offsets are advanced past this Urysohn
+	void Accumulate(T delta, const std::unique_ptr<T[]>& inputs, UpdateBuffer<A>& buffer,
+		int& knotOffset, int& functionOffset) const {
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			int k = _tables[n];
+			T x = inputs[k];
+			if (x < _xmin[k] || x > _xmax[k]) {
+				buffer.ExtendLimits(functionOffset + k, x, x);
+			}
+			int last = (int)_model[k].size() - 1;
+			int index;
+			T offset = GetOffset(k, x, index);
+			T tmp = delta * offset;
+			buffer.AddKnot(knotOffset + index + 1, tmp);
+			buffer.AddKnot(knotOffset + index, delta - tmp);
+			knotOffset += last + 1;
+		}
+		functionOffset += (int)_model.size();
+	}
+	//Consumes entries of the sorted buffer lists that belong to this Urysohn
+	void ApplyBuffer(const UpdateBuffer<A>& buffer, int& knotPosition, int& functionPosition,
+		int& knotOffset, int& functionOffset) {
+		const std::vector<int>& functions = buffer.GetFunctionList();
+		while (functionPosition < (int)functions.size() && functions[functionPosition] < functionOffset + (int)_model.size()) {
+			int n = functions[functionPosition++];
+			int k = n - functionOffset;
+			bool changed = false;
+			Materialize(k);
+			if (buffer.GetMin(n) < _xmin[k]) {
+				_xmin[k] = static_cast<T>(buffer.GetMin(n));
+				changed = true;
+			}
+			if (buffer.GetMax(n) > _xmax[k]) {
+				_xmax[k] = static_cast<T>(buffer.GetMax(n));
+				changed = true;
+			}
+			if (changed) {
+				SetLimits(k);
+				TouchLimits(k);
+			}
+		}
+		functionOffset += (int)_model.size();
+		const std::vector<int>& knots = buffer.GetKnotList();
+		int end = knotOffset + GetNumberOfKnots();
+		if (end == knotOffset) return;
+		int k = 0;
+		int functionEnd = knotOffset + (int)_model[0].size();
+		while (knotPosition < (int)knots.size() && knots[knotPosition] < end) {
+			int n = knots[knotPosition++];
+			while (n >= functionEnd) {
+				knotOffset = functionEnd;
+				functionEnd += (int)_model[++k].size();
+			}
+			int j = n - knotOffset;
+			_model[k][j] += static_cast<T>(buffer.GetKnot(n));
+			Tabulate(k, j - 1, j);
+			Touch(k, j);
+		}
+		knotOffset = end;
+		RefreshBaseline();
+	}
+	//Counter of changes of limits, points and kinds of functions, binned inputs are valid while it stays
+	long long GetGridVersion() const {
+		return _gridVersion;
+	}
+	//False for compacted functions
+	bool GetGrid(int k, T& xmin, T& xmax, T& invdeltax, int& points) const {
+		if (_model[k].empty()) return false;
+		xmin = _xmin[k];
+		xmax = _xmax[k];
+		invdeltax = _invdeltax[k];
+		points = (int)_model[k].size();
+		return true;
+	}
+	int GetNumberOfKnots() const {
+		int n = 0;
+		for (int i = 0; i < (int)_model.size(); ++i) {
+			n += (int)_model[i].size();
+		}
+		return n;
+	}
+	int GetNumberOfFunctions() const {
+		return (int)_model.size();
+	}
+	void GetKnots(std::vector<double>& knots) const {
+		for (int i = 0; i < (int)_model.size(); ++i) {
+			for (int j = 0; j < (int)_model[i].size(); ++j) {
+				knots.push_back(_model[i][j] + GetDeferredKnot(i, j));
+			}
+		}
+	}
+	//Deferred updates are dropped, knots are replaced
+	void SetKnots(const std::vector<double>& knots, int& position) {
+		_zeroTotal = 0;
+		_zeroStamps.assign(_model.size(), 0);
+		_nDeferred = 0;
+		for (int i = 0; i < (int)_model.size(); ++i) {
+			for (int j = 0; j < (int)_model[i].size(); ++j) {
+				_model[i][j] = static_cast<T>(knots[position++]);
+				Touch(i, j);
+			}
+			Tabulate(i);
+		}
+		RefreshBaseline();
+	}
+	void GetLimits(std::vector<double>& xmin, std::vector<double>& xmax) const {
+		for (int i = 0; i < (int)_model.size(); ++i) {
+			xmin.push_back(_xmin[i]);
+			xmax.push_back(_xmax[i]);
+		}
+	}
+	//Functions are resampled on the new grids, values inside old limits are preserved
+	void ResetLimits(const std::vector<double>& xmin, const std::vector<double>& xmax, int& position) {
+		for (int i = 0; i < (int)_model.size(); ++i) {
+			Resample(i, static_cast<T>(xmin[position]), static_cast<T>(xmax[position]));
+			++position;
+		}
+	}
 	void IncrementPoints() {
-		for (int i = 0; i < _model.size(); ++i) {
-			IncrementPoints(i);
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			IncrementPoints(_tables[n]);
+		}
+	}
+	//Optional counters of hits and absolute updates of each segment in Train
+	void EnableTelemetry(bool enable) {
+		_hits.clear();
+		_magnitudes.clear();
+		if (!enable) return;
+		_hits = std::vector<std::vector<long long>>(_model.size());
+		_magnitudes = std::vector<std::vector<double>>(_model.size());
+		for (int k = 0; k < (int)_model.size(); ++k) {
+			ResetTelemetry(k);
+		}
+	}
+	void GetTelemetry(std::vector<FunctionTelemetry>& telemetry) const {
+		for (int k = 0; k < (int)_model.size(); ++k) {
+			FunctionTelemetry function = { (int)_model[k].size(), 0, 0, 0, 0, 0.0 };
+			if (!_hits.empty()) {
+				int segments = (int)_hits[k].size();
+				for (int j = 0; j < segments; ++j) {
+					if (_hits[k][j] > 0) ++function.occupiedSegments;
+					function.hits += _hits[k][j];
+					function.magnitude += _magnitudes[k][j];
+				}
+				//cold segments have less than quarter of even share of hits, in hot segments mean update
+				//stays half as large again as mean of the function, linear piece does not fit there
+				for (int j = 0; j < segments; ++j) {
+					if (4 * segments * _hits[k][j] < function.hits) ++function.coldSegments;
+					else if (_magnitudes[k][j] * function.hits > 1.5 * function.magnitude * _hits[k][j]) ++function.hotSegments;
+				}
+			}
+			telemetry.push_back(function);
+		}
+	}
+	//Functions are resampled to the given numbers of points, compacted functions are skipped
+	void Regrid(const std::vector<int>& points, int& position) {
+		for (int k = 0; k < (int)_model.size(); ++k) {
+			int n = points[position++];
+			if (_model[k].empty() || n < 2 || n == (int)_model[k].size()) continue;
+			SetPoints(k, n);
+		}
+	}
+	//Constant functions are folded into bias and nearly linear functions are replaced by slope and intercept,
+	//tolerances are maximum deviations in knots. Knot tables of compacted functions are released.
+	void Compact(double constantTolerance, double linearTolerance, int& nConstants, int& nLines) {
+		Flush();
+		++_gridVersion;
+		_journalStructure = true;
+		std::vector<int> tables;
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			int k = _tables[n];
+			int points = (int)_model[k].size();
+			double mean = 0.0;
+			for (int j = 0; j < points; ++j) {
+				mean += _model[k][j];
+			}
+			mean /= points;
+			double deviation = 0.0;
+			for (int j = 0; j < points; ++j) {
+				deviation = std::max(deviation, std::abs(_model[k][j] - mean));
+			}
+			if (deviation <= constantTolerance) {
+				_bias += static_cast<T>(mean);
+				_constants.push_back(k);
+				_model[k].clear();
+				_segments[k].clear();
+				if (!_hits.empty()) ResetTelemetry(k);
+				++nConstants;
+				continue;
+			}
+			//least squares line over knots, the argument is knot position
+			double xmean = (_xmin[k] + _xmax[k]) / 2.0;
+			double sxy = 0.0;
+			double sxx = 0.0;
+			for (int j = 0; j < points; ++j) {
+				double x = _xmin[k] + j * _deltax[k] - xmean;
+				sxy += x * (_model[k][j] - mean);
+				sxx += x * x;
+			}
+			double slope = sxy / sxx;
+			double intercept = mean - slope * xmean;
+			deviation = 0.0;
+			for (int j = 0; j < points; ++j) {
+				double x = _xmin[k] + j * _deltax[k];
+				deviation = std::max(deviation, std::abs(_model[k][j] - intercept - slope * x));
+			}
+			if (deviation <= linearTolerance) {
+				_slope[k] = static_cast<T>(slope);
+				_intercept[k] = static_cast<T>(intercept);
+				_lines.push_back(k);
+				_model[k].clear();
+				_segments[k].clear();
+				if (!_hits.empty()) ResetTelemetry(k);
+				++nLines;
+				continue;
+			}
+			tables.push_back(k);
+		}
+		_tables = tables;
+		std::sort(_lines.begin(), _lines.end());
+		std::sort(_constants.begin(), _constants.end());
+		RefreshBaseline();
+	}
+	//Variation of the function over its limits
+	T GetFunctionRange(int k) const {
+		if (std::find(_lines.begin(), _lines.end(), k) != _lines.end()) {
+			return std::abs(_slope[k]) * (_xmax[k] - _xmin[k]);
+		}
+		if (_model[k].empty()) return 0;
+		return *std::max_element(_model[k].begin(), _model[k].end()) - *std::min_element(_model[k].begin(), _model[k].end());
+	}
+	//Function is replaced by its value in the middle of its limits, which is added to bias
+	void RemoveFunction(int k) {
+		Flush();
+		++_gridVersion;
+		_journalStructure = true;
+		if (!_journalKnots.empty()) {
+			_journalKnots.erase(_journalKnots.begin() + k);
+			_journalLimits.erase(_journalLimits.begin() + k);
+		}
+		_bias += GetAnyFunction(k, (_xmin[k] + _xmax[k]) / 2);
+		_model.erase(_model.begin() + k);
+		_xmin.erase(_xmin.begin() + k);
+		_xmax.erase(_xmax.begin() + k);
+		_deltax.erase(_deltax.begin() + k);
+		_invdeltax.erase(_invdeltax.begin() + k);
+		_segments.erase(_segments.begin() + k);
+		if (!_hits.empty()) {
+			_hits.erase(_hits.begin() + k);
+			_magnitudes.erase(_magnitudes.begin() + k);
+		}
+		_slope.erase(_slope.begin() + k);
+		_intercept.erase(_intercept.begin() + k);
+		RemoveIndex(_tables, k);
+		RemoveIndex(_lines, k);
+		RemoveIndex(_constants, k);
+		RefreshBaseline();
+	}
+	//Optional record of changed knots and limits for replicas
+	void EnableJournal(bool enable) {
+		_journalKnots.clear();
+		_journalKnotList.clear();
+		_journalLimits.clear();
+		_journalLimitList.clear();
+		_journalStructure = false;
+		if (!enable) return;
+		_journalKnots = std::vector<std::vector<char>>(_model.size());
+		for (int k = 0; k < (int)_model.size(); ++k) {
+			_journalKnots[k].assign(_model[k].size(), 0);
+		}
+		_journalLimits.assign(_model.size(), 0);
+	}
+	//Moves changes since previous call to the journal, offsets are advanced past this Urysohn
+	void GetJournal(ModelJournal& journal, int& knotOffset, int& functionOffset) {
+		if (_nDeferred > 0) Flush();
+		if (_journalKnots.empty() || _journalStructure) {
+			journal.SetFull();
+		}
+		else {
+			std::vector<int> starts(_model.size());
+			int start = knotOffset;
+			for (int k = 0; k < (int)_model.size(); ++k) {
+				starts[k] = start;
+				start += (int)_model[k].size();
+			}
+			for (int n = 0; n < (int)_journalLimitList.size(); ++n) {
+				int k = _journalLimitList[n];
+				journal.AddLimits(functionOffset + k, _xmin[k], _xmax[k]);
+				_journalLimits[k] = 0;
+			}
+			for (int n = 0; n < (int)_journalKnotList.size(); ++n) {
+				int k = _journalKnotList[n].first;
+				int j = _journalKnotList[n].second;
+				journal.AddKnot(starts[k] + j, _model[k][j]);
+				_journalKnots[k][j] = 0;
+			}
+			_journalKnotList.clear();
+			_journalLimitList.clear();
+		}
+		if (_journalStructure && !_journalKnots.empty()) EnableJournal(true);
+		knotOffset += GetNumberOfKnots();
+		functionOffset += (int)_model.size();
+	}
+	//Consumes entries of the sorted journal that belong to this Urysohn, grids of replica are the same as of the model
+	void ApplyJournal(const ModelJournal& journal, int& knotPosition, int& functionPosition, int& knotOffset, int& functionOffset) {
+		std::vector<int> changed;
+		const std::vector<int>& functions = journal.GetFunctionList();
+		while (functionPosition < (int)functions.size() && functions[functionPosition] < functionOffset + (int)_model.size()) {
+			int k = functions[functionPosition] - functionOffset;
+			++_gridVersion;
+			_xmin[k] = static_cast<T>(journal.GetMin(functionPosition));
+			_xmax[k] = static_cast<T>(journal.GetMax(functionPosition));
+			if (_model[k].size() > 1) {
+				_deltax[k] = (_xmax[k] - _xmin[k]) / (_model[k].size() - 1);
+				_invdeltax[k] = 1 / _deltax[k];
+			}
+			changed.push_back(k);
+			++functionPosition;
+		}
+		functionOffset += (int)_model.size();
+		const std::vector<int>& knots = journal.GetKnotList();
+		int end = knotOffset + GetNumberOfKnots();
+		int k = 0;
+		int functionEnd = knotOffset + (_model.empty() ? 0 : (int)_model[0].size());
+		while (knotPosition < (int)knots.size() && knots[knotPosition] < end) {
+			int n = knots[knotPosition];
+			while (n >= functionEnd) {
+				knotOffset = functionEnd;
+				functionEnd += (int)_model[++k].size();
+			}
+			int j = n - knotOffset;
+			_model[k][j] = static_cast<T>(journal.GetKnot(knotPosition));
+			Tabulate(k, j - 1, j);
+			if (changed.empty() || changed.back() != k) changed.push_back(k);
+			++knotPosition;
+		}
+		knotOffset = end;
+		for (int n = 0; n < (int)changed.size(); ++n) {
+			RefreshBaseline(changed[n]);
+		}
+	}
+	//Tables with deferred updates and lines as tables of two knots, constants are in bias
+	template <typename P>
+	void Pack(PackedModel<P>& packed) const {
+		packed.AddUrysohn(static_cast<P>(_bias));
+		std::vector<P> knots;
+		for (int n = 0; n < (int)_tables.size(); ++n) {
+			int k = _tables[n];
+			knots.clear();
+			for (int j = 0; j < (int)_model[k].size(); ++j) {
+				knots.push_back(static_cast<P>(_model[k][j] + GetDeferredKnot(k, j)));
+			}
+			packed.AddFunction(k, static_cast<P>(_xmin[k]), static_cast<P>(_invdeltax[k]), knots);
+		}
+		for (int n = 0; n < (int)_lines.size(); ++n) {
+			int k = _lines[n];
+			knots.clear();
+			knots.push_back(static_cast<P>(GetLine(k, _xmin[k])));
+			knots.push_back(static_cast<P>(GetLine(k, _xmax[k])));
+			packed.AddFunction(k, static_cast<P>(_xmin[k]), static_cast<P>(1 / (_xmax[k] - _xmin[k])), knots);
 		}
 	}
 	void ShowData() {
@@ -101,76 +636,286 @@ public:
 		printf("\n");
 	}
 private:
-	std::vector<std::vector<double>> _model;
-	std::vector<double> _xmin;
-	std::vector<double> _xmax;
-	std::vector<double> _deltax;
+	std::vector<std::vector<T>> _model;
+	std::vector<T> _xmin;
+	std::vector<T> _xmax;
+	std::vector<T> _deltax;
+	//evaluation tables kept in sync with _model, pairs of knot value and difference to the next knot
+	//for each segment, and reciprocal of grid step, so that lookups do not divide
+	std::vector<T> _invdeltax;
+	std::vector<std::vector<T>> _segments;
+	//per segment telemetry, empty when disabled
+	std::vector<std::vector<long long>> _hits;
+	std::vector<std::vector<double>> _magnitudes;
+	//values of functions at zero for sparse inputs, segments and offsets of zero and weights of zero in
+	//own update, which are squares of offsets to knots. Function k owes deferred update of the sum of deltas
+	//from _zeroStamps[k] to _zeroTotal, the sum of all functions at zero is _zeroSum + _zeroTotal * _zeroWeight - _stampSum.
+	std::vector<T> _zeros;
+	std::vector<int> _zeroSegments;
+	std::vector<T> _zeroOffsets;
+	std::vector<T> _zeroWeights;
+	std::vector<A> _zeroStamps;
+	A _zeroSum = 0;
+	A _zeroWeight = 0;
+	A _stampSum = 0;
+	A _zeroTotal = 0;
+	int _nDeferred = 0;
+	//changes since last journal, empty when disabled, changed knots are listed once as pairs of function and knot
+	std::vector<std::vector<char>> _journalKnots;
+	std::vector<std::pair<int, int>> _journalKnotList;
+	std::vector<char> _journalLimits;
+	std::vector<int> _journalLimitList;
+	bool _journalStructure = false;
+	//kinds of functions after compaction, sorted indexes
+	std::vector<int> _tables;
+	std::vector<int> _lines;
+	std::vector<int> _constants;
+	std::vector<T> _slope;
+	std::vector<T> _intercept;
+	T _bias = 0;
+	long long _gridVersion = 0;
+	static void RemoveIndex(std::vector<int>& list, int k) {
+		auto it = std::find(list.begin(), list.end(), k);
+		if (it != list.end()) list.erase(it);
+		for (int n = 0; n < (int)list.size(); ++n) {
+			if (list[n] > k) --list[n];
+		}
+	}
+	T GetLine(int k, T x) const {
+		if (x < _xmin[k]) x = _xmin[k];
+		if (x > _xmax[k]) x = _xmax[k];
+		return _intercept[k] + _slope[k] * x;
+	}
+	//Value of function of any kind, constant functions are already in bias
+	T GetAnyFunction(int k, T x) const {
+		if (std::find(_lines.begin(), _lines.end(), k) != _lines.end()) return GetLine(k, x);
+		if (_model[k].empty()) return 0;
+		return GetFunction(k, x);
+	}
 	void SetLimits(int k) {
-		double range = _xmax[k] - _xmin[k];
-		_xmin[k] -= 0.01 * range;
-		_xmax[k] += 0.01 * range;
+		++_gridVersion;
+		T range = _xmax[k] - _xmin[k];
+		_xmin[k] -= static_cast<T>(0.01) * range;
+		_xmax[k] += static_cast<T>(0.01) * range;
 		_deltax[k] = (_xmax[k] - _xmin[k]) / (_model[k].size() - 1);
+		_invdeltax[k] = 1 / _deltax[k];
+	}
+	//Refreshes segments from first to last, whole table by default
+	void Tabulate(int k, int first = 0, int last = -1) {
+		int segments = (int)_model[k].size() - 1;
+		if ((int)_segments[k].size() != 2 * segments) {
+			_segments[k].resize(2 * segments);
+			first = 0;
+			last = segments - 1;
+		}
+		if (last < 0 || last > segments - 1) last = segments - 1;
+		if (first < 0) first = 0;
+		for (int j = first; j <= last; ++j) {
+			_segments[k][2 * j] = _model[k][j];
+			_segments[k][2 * j + 1] = _model[k][j + 1] - _model[k][j];
+		}
+	}
+	//Position of x in the grid clamped to limits, returns offset inside segment index
+	T GetOffset(int k, T x, int& index) const {
+		T R = (x - _xmin[k]) * _invdeltax[k];
+		R = std::min(std::max(R, T(0)), static_cast<T>(_model[k].size() - 1));
+		index = std::min((int)R, (int)_model[k].size() - 2);
+		return R - index;
 	}
 	void IncrementPoints(int k) {
-		int points = (int)_model[k].size() + 1;
-		double deltax = (_xmax[k] - _xmin[k]) / (points - 1);
-		std::vector<double> y(points);
+		SetPoints(k, (int)_model[k].size() + 1);
+	}
+	void SetPoints(int k, int points) {
+		++_gridVersion;
+		Materialize(k);
+		_journalStructure = true;
+		if (!_journalKnots.empty()) _journalKnots[k].assign(points, 0);
+		T deltax = (_xmax[k] - _xmin[k]) / (points - 1);
+		std::vector<T> y(points);
 		y[0] = _model[k][0];
 		y[points - 1] = _model[k][_model[k].size() - 1];
 		for (int i = 1; i < points - 1; ++i) {
 			y[i] = GetFunction(k, _xmin[k] + i * deltax);
 		}
 		_deltax[k] = deltax;
+		_invdeltax[k] = 1 / deltax;
 		_model[k].clear();
 		for (int i = 0; i < y.size(); i++)
 		{
 			_model[k].push_back(y[i]);
 		}
+		Tabulate(k);
+		RefreshBaseline(k);
+		if (!_hits.empty()) ResetTelemetry(k);
+	}
+	//Stamps are kept, their size is reset only when there are no deferred updates
+	void RefreshBaseline() {
+		_zeros.assign(_model.size(), 0);
+		_zeroSegments.assign(_model.size(), -2);
+		_zeroOffsets.assign(_model.size(), 0);
+		_zeroWeights.assign(_model.size(), 0);
+		if (_zeroStamps.size() != _model.size()) _zeroStamps.assign(_model.size(), 0);
+		_zeroSum = 0;
+		_zeroWeight = 0;
+		_stampSum = 0;
+		for (int k = 0; k < (int)_model.size(); ++k) {
+			RefreshBaseline(k);
+		}
+	}
+	//Segment of zero may change only when function has no deferred update
+	void RefreshBaseline(int k) {
+		_zeroSum -= _zeros[k];
+		_zeroWeight -= _zeroWeights[k];
+		_stampSum -= _zeroStamps[k] * _zeroWeights[k];
+		if (_model[k].empty()) {
+			_zeros[k] = GetLine(k, 0);
+			_zeroSegments[k] = -2;
+			_zeroOffsets[k] = 0;
+			_zeroWeights[k] = 0;
+		}
+		else {
+			T offset = GetOffset(k, 0, _zeroSegments[k]);
+			_zeros[k] = GetFunction(k, 0);
+			_zeroOffsets[k] = offset;
+			_zeroWeights[k] = (1 - offset) * (1 - offset) + offset * offset;
+		}
+		_zeroSum += _zeros[k];
+		_zeroWeight += _zeroWeights[k];
+		_stampSum += _zeroStamps[k] * _zeroWeights[k];
+	}
+	//Deferred update is added to the two knots around zero as Update at zero does
+	void Materialize(int k) {
+		A deferred = _zeroTotal - _zeroStamps[k];
+		if (deferred == 0 || _model[k].empty()) return;
+		int index = _zeroSegments[k];
+		T residual = static_cast<T>(deferred);
+		T tmp = residual * _zeroOffsets[k];
+		_model[k][index + 1] += tmp;
+		_model[k][index] += residual - tmp;
+		Tabulate(k, index - 1, index + 1);
+		Touch(k, index);
+		Touch(k, index + 1);
+		_stampSum += deferred * _zeroWeights[k];
+		_zeroStamps[k] = _zeroTotal;
+		RefreshBaseline(k);
+	}
+	T GetDeferredKnot(int k, int j) const {
+		if (_nDeferred == 0 || j < _zeroSegments[k] || j > _zeroSegments[k] + 1) return 0;
+		T residual = static_cast<T>(_zeroTotal - _zeroStamps[k]);
+		T tmp = residual * _zeroOffsets[k];
+		return j == _zeroSegments[k] ? residual - tmp : tmp;
+	}
+	//Deferred part of function value, nonzero only near zero
+	T GetDeferred(int k, T x, T& derivative) const {
+		int index;
+		T offset = GetOffset(k, x, index);
+		T left = GetDeferredKnot(k, index);
+		T right = GetDeferredKnot(k, index + 1);
+		derivative = (right - left) * _invdeltax[k];
+		return left + (right - left) * offset;
+	}
+	void Touch(int k, int j) {
+		if (_journalKnots.empty() || _journalKnots[k][j]) return;
+		_journalKnots[k][j] = 1;
+		_journalKnotList.push_back(std::make_pair(k, j));
+	}
+	void TouchLimits(int k) {
+		if (_journalKnots.empty() || _journalLimits[k]) return;
+		_journalLimits[k] = 1;
+		_journalLimitList.push_back(k);
+	}
+	void ResetTelemetry(int k) {
+		int segments = std::max((int)_model[k].size() - 1, 0);
+		_hits[k].assign(segments, 0);
+		_magnitudes[k].assign(segments, 0.0);
+	}
+	void Resample(int k, T xmin, T xmax) {
+		if (xmin == _xmin[k] && xmax == _xmax[k]) return;
+		if (_model[k].empty()) return;
+		++_gridVersion;
+		Materialize(k);
+		int points = (int)_model[k].size();
+		T deltax = (xmax - xmin) / (points - 1);
+		std::vector<T> y(points);
+		for (int i = 0; i < points; ++i) {
+			y[i] = GetFunction(k, xmin + i * deltax);
+		}
+		_xmin[k] = xmin;
+		_xmax[k] = xmax;
+		_deltax[k] = deltax;
+		_invdeltax[k] = 1 / deltax;
+		_model[k] = y;
+		Tabulate(k);
+		RefreshBaseline(k);
+		TouchLimits(k);
+		for (int j = 0; j < points; ++j) {
+			Touch(k, j);
+		}
 	}
-	void Update(int k, double x, double residual) {
+	void Update(int k, T x, T residual) {
+		bool limitsChanged = false;
+		if (x < _xmin[k] || x > _xmax[k]) {
+			Materialize(k);
+			TouchLimits(k);
+		}
 		if (x < _xmin[k]) {
 			_xmin[k] = x;
 			SetLimits(k);
+			limitsChanged = true;
 		}
 		if (x > _xmax[k]) {
 			_xmax[k] = x;
 			SetLimits(k);
+			limitsChanged = true;
 		}
-		double R = (x - _xmin[k]) / _deltax[k];
-		int index = (int)(R);
-		double offset = R - index;
-		double tmp = residual * offset;
-		_model[k][index + 1] += tmp;
-		_model[k][index] += residual - tmp;
+		int index;
+		T offset = GetOffset(k, x, index);
+		UpdateSegment(k, index, offset, residual, limitsChanged);
 	}
-	double GetFunction(int k, double x, double& derivative) {
-		if (x <= _xmin[k]) {
-			int index = 0;
-			derivative = (_model[k][index + 1] - _model[k][index]) / _deltax[k];
-			return _model[k][0];
+	//Two knots of the segment of x are moved, offset is position of x inside the segment
+	void UpdateSegment(int k, int index, T offset, T residual, bool limitsChanged) {
+		if (!_hits.empty()) {
+			++_hits[k][index];
+			_magnitudes[k][index] += std::abs(residual);
 		}
-		if (x >= _xmax[k]) {
-			int index = (int)_model[k].size() - 2;
-			derivative = (_model[k][index + 1] - _model[k][index]) / _deltax[k];
-			return _model[k][_model[k].size() - 1];
+		if (!_journalKnots.empty()) {
+			Touch(k, index);
+			Touch(k, index + 1);
 		}
-		double R = (x - _xmin[k]) / _deltax[k];
-		int index = (int)(R);
-		derivative = (_model[k][index + 1] - _model[k][index]) / _deltax[k];
-		double offset = R - index;
-		return _model[k][index] + (_model[k][index + 1] - _model[k][index]) * offset;
-	}
-	double GetFunction(int k, double x) {
-		if (x <= _xmin[k]) {
-			return _model[k][0];
+		T tmp = residual * offset;
+		T* model = _model[k].data();
+		model[index + 1] += tmp;
+		model[index] += residual - tmp;
+		//two knots are changed, they are in three segments
+		T* segment = &_segments[k][2 * index];
+		segment[0] = model[index];
+		segment[1] = model[index + 1] - model[index];
+		if (index > 0) segment[-1] = model[index] - model[index - 1];
+		if (index + 2 < (int)_model[k].size()) {
+			segment[2] = model[index + 1];
+			segment[3] = model[index + 2] - model[index + 1];
 		}
-		if (x >= _xmax[k]) {
-			return _model[k][_model[k].size() - 1];
+		//value at zero depends on two knots of its segment
+		if (limitsChanged || (index >= _zeroSegments[k] - 1 && index <= _zeroSegments[k] + 1)) {
+			RefreshBaseline(k);
 		}
-		double R = (x - _xmin[k]) / _deltax[k];
-		int index = (int)(R);
-		double offset = R - index;
-		return _model[k][index] + (_model[k][index + 1] - _model[k][index]) * offset;
+	}
+	T GetFunction(int k, T x, T& derivative) const {
+		int index;
+		T offset = GetOffset(k, x, index);
+		const T* segment = &_segments[k][2 * index];
+		derivative = segment[1] * _invdeltax[k];
+		return segment[0] + segment[1] * offset;
+	}
+	T GetCell(int k, int index, T offset, T& derivative) const {
+		const T* segment = &_segments[k][2 * index];
+		derivative = segment[1] * _invdeltax[k];
+		return segment[0] + segment[1] * offset;
+	}
+	T GetFunction(int k, T x) const {
+		int index;
+		T offset = GetOffset(k, x, index);
+		const T* segment = &_segments[k][2 * index];
+		return segment[0] + segment[1] * offset;
 	}
 };
-
@@ -0,0 +1,49 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+//Scratch buffers for one prediction call. The model itself is read only during prediction,
+//so each thread owns a workspace and any number of threads can share a single KANKAN instance.
+//Workspace constructed with number of features holds also deltas and derivatives for training.
+template <typename T = double>
+class Workspace {
+public:
+	Workspace(const std::vector<int>& U) {
+		for (int k = 0; k < (int)U.size(); ++k) {
+			_models.push_back(std::make_unique<T[]>(U[k]));
+			_U.push_back(U[k]);
+		}
+	}
+	Workspace(const std::vector<int>& U, int nFeatures) : Workspace(U) {
+		for (int k = 0; k < (int)U.size(); ++k) {
+			_deltas.push_back(std::make_unique<T[]>(U[k]));
+			int nInputs = (k == 0) ? nFeatures : U[k - 1];
+			auto derivatives = std::make_unique<std::unique_ptr<T[]>[]>(U[k]);
+			for (int i = 0; i < U[k]; ++i) {
+				derivatives[i] = std::make_unique<T[]>(nInputs);
+			}
+			_derivatives.push_back(std::move(derivatives));
+		}
+	}
+	bool Fits(const std::vector<int>& U) const {
+		if (U.size() != _U.size()) return false;
+		for (int k = 0; k < (int)U.size(); ++k) {
+			if (U[k] > _U[k]) return false;
+		}
+		return true;
+	}
+	std::unique_ptr<T[]>& Models(int k) {
+		return _models[k];
+	}
+	std::unique_ptr<T[]>& Deltas(int k) {
+		return _deltas[k];
+	}
+	std::unique_ptr<std::unique_ptr<T[]>[]>& Derivatives(int k) {
+		return _derivatives[k];
+	}
+private:
+	std::vector<std::unique_ptr<T[]>> _models;
+	std::vector<std::unique_ptr<T[]>> _deltas;
+	std::vector<std::unique_ptr<std::unique_ptr<T[]>[]>> _derivatives;
+	std::vector<int> _U;
+};